@@ -5,4 +5,4 @@ export PATH="/usr/bin:$PATH"
 
 mkdir -p build && cd build
 cmake -DWGTCC_COVERAGE=ON .. && make -j16
-cd ../test/ && ./run_tests.sh
+cd ../test/ && ./run_tests.sh && WGTCC_FLAGS=-O1 ./run_tests.sh
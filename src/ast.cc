@@ -7,6 +7,8 @@
 #include "parser.h"
 #include "token.h"
 
+#include <algorithm>
+
 
 static MemPoolImp<BinaryOp>         binaryOpPool;
 static MemPoolImp<ConditionalOp>    conditionalOpPool;
@@ -20,6 +22,8 @@ static MemPoolImp<TempVar>          tempVarPool;
 static MemPoolImp<UnaryOp>          unaryOpPool;
 static MemPoolImp<EmptyStmt>        emptyStmtPool;
 static MemPoolImp<IfStmt>           ifStmtPool;
+static MemPoolImp<SwitchStmt>       switchStmtPool;
+static MemPoolImp<LoopStmt>         loopStmtPool;
 static MemPoolImp<JumpStmt>         jumpStmtPool;
 static MemPoolImp<ReturnStmt>       returnStmtPool;
 static MemPoolImp<LabelStmt>        labelStmtPool;
@@ -51,6 +55,16 @@ void IfStmt::Accept(Visitor* v) {
 }
 
 
+void SwitchStmt::Accept(Visitor* v) {
+  v->VisitSwitchStmt(this);
+}
+
+
+void LoopStmt::Accept(Visitor* v) {
+  v->VisitLoopStmt(this);
+}
+
+
 void JumpStmt::Accept(Visitor* v) {
   v->VisitJumpStmt(this);
 }
@@ -663,12 +677,22 @@ Declaration* Declaration::New(Object* obj) {
 
 void Declaration::AddInit(Initializer init) {
   init.expr_ = Expr::MayCast(init.expr_, init.type_);
+  inits_.push_back(init);
+}
+
 
-  auto res = inits_.insert(init);
-  if (!res.second) {
-    inits_.erase(res.first);
-    inits_.insert(init);
+// Designators may come in any order and initialize an element again,
+// sort them by offset once the initializer is parsed, the last one wins
+void Declaration::FinishInits() {
+  std::stable_sort(inits_.begin(), inits_.end());
+  auto last = inits_.begin();
+  for (auto iter = inits_.begin(); iter != inits_.end(); ++iter) {
+    if (last != inits_.begin() && !(*(last - 1) < *iter))
+      *(last - 1) = *iter;
+    else
+      *last++ = *iter;
   }
+  inits_.erase(last, inits_.end());
 }
 
 
@@ -784,6 +808,24 @@ IfStmt* IfStmt::New(Expr* cond, Stmt* then, Stmt* els) {
 }
 
 
+SwitchStmt* SwitchStmt::New(Expr* cond) {
+  auto ret = new (switchStmtPool.Alloc()) SwitchStmt(cond);
+  ret->pool_ = &switchStmtPool;
+  return ret;
+}
+
+
+// The cond and step could be null
+LoopStmt* LoopStmt::New(Expr* cond, Stmt* body, Expr* step,
+                        LabelStmt* continueLabel, LabelStmt* breakLabel,
+                        bool doWhile) {
+  auto ret = new (loopStmtPool.Alloc())
+      LoopStmt(cond, body, step, continueLabel, breakLabel, doWhile);
+  ret->pool_ = &loopStmtPool;
+  return ret;
+}
+
+
 CompoundStmt* CompoundStmt::New(std::list<Stmt*>& stmts, ::Scope* scope) {
   auto ret = new (compoundStmtPool.Alloc()) CompoundStmt(stmts, scope);
   ret->pool_ = &compoundStmtPool;
@@ -9,6 +9,7 @@
 #include <list>
 #include <memory>
 #include <string>
+#include <vector>
 
 
 class Visitor;
@@ -40,6 +41,8 @@ class Enumerator;
 // Statements
 class Stmt;
 class IfStmt;
+class SwitchStmt;
+class LoopStmt;
 class JumpStmt;
 class LabelStmt;
 class EmptyStmt;
@@ -56,6 +59,7 @@ class ASTNode {
 public:
   virtual ~ASTNode() {}
   virtual void Accept(Visitor* v) = 0;
+  virtual FuncDef* ToFuncDef() { return nullptr; }
 
 protected:
   ASTNode() {}
@@ -73,6 +77,9 @@ using ExtDecl = ASTNode;
 class Stmt : public ASTNode {
 public:
   virtual ~Stmt() {}
+  virtual JumpStmt* ToJumpStmt() { return nullptr; }
+  virtual CompoundStmt* ToCompoundStmt() { return nullptr; }
+  virtual Expr* ToExpr() { return nullptr; }
 
 protected:
    Stmt() {}
@@ -83,6 +90,8 @@ class EmptyStmt : public Stmt {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
 
 public:
   static EmptyStmt* New();
@@ -98,6 +107,8 @@ class LabelStmt : public Stmt {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
 
 public:
   static LabelStmt* New();
@@ -122,6 +133,8 @@ class IfStmt : public Stmt {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
 public:
   static IfStmt* New(Expr* cond, Stmt* then, Stmt* els=nullptr);
   virtual ~IfStmt() {}
@@ -138,15 +151,82 @@ private:
 };
 
 
+using CaseList = std::vector<std::pair<long, LabelStmt*>>;
+
+// Jumps to the label of the case equal to 'cond_', or to 'default_'
+class SwitchStmt : public Stmt {
+  template<typename T> friend class Evaluator;
+  friend class AddrEvaluator;
+  friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
+
+public:
+  static SwitchStmt* New(Expr* cond);
+  virtual ~SwitchStmt() {}
+  virtual void Accept(Visitor* v);
+  void AddCase(long val, LabelStmt* label) { cases_.push_back({val, label}); }
+  void SetDefault(LabelStmt* label) { default_ = label; }
+
+protected:
+  SwitchStmt(Expr* cond): cond_(cond), default_(nullptr) {}
+
+private:
+  Expr* cond_;
+  CaseList cases_;
+  LabelStmt* default_;
+};
+
+
+/*
+ * A loop kept structured for the backend, which rotates it:
+ * 'cond_' guards the first iteration unless 'doWhile_',
+ * and is tested again after 'step_' at the bottom.
+ * 'continue_' precedes the step, 'break_' follows the loop.
+ * A null 'cond_' loops forever.
+ */
+class LoopStmt : public Stmt {
+  template<typename T> friend class Evaluator;
+  friend class AddrEvaluator;
+  friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
+
+public:
+  static LoopStmt* New(Expr* cond, Stmt* body, Expr* step,
+                       LabelStmt* continueLabel, LabelStmt* breakLabel,
+                       bool doWhile=false);
+  virtual ~LoopStmt() {}
+  virtual void Accept(Visitor* v);
+
+protected:
+  LoopStmt(Expr* cond, Stmt* body, Expr* step,
+           LabelStmt* continueLabel, LabelStmt* breakLabel, bool doWhile)
+      : cond_(cond), body_(body), step_(step), continue_(continueLabel),
+        break_(breakLabel), doWhile_(doWhile) {}
+
+private:
+  Expr* cond_;
+  Stmt* body_;
+  Expr* step_;
+  LabelStmt* continue_;
+  LabelStmt* break_;
+  bool doWhile_;
+};
+
+
 class JumpStmt : public Stmt {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
 
 public:
   static JumpStmt* New(LabelStmt* label);
   virtual ~JumpStmt() {}
   virtual void Accept(Visitor* v);
+  virtual JumpStmt* ToJumpStmt() { return this; }
   void SetLabel(LabelStmt* label) { label_ = label; }
 
 protected:
@@ -161,6 +241,8 @@ class ReturnStmt: public Stmt {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
 
 public:
   static ReturnStmt* New(Expr* expr);
@@ -181,11 +263,14 @@ class CompoundStmt : public Stmt {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
 
 public:
   static CompoundStmt* New(StmtList& stmts, ::Scope* scope=nullptr);
   virtual ~CompoundStmt() {}
   virtual void Accept(Visitor* v);
+  virtual CompoundStmt* ToCompoundStmt() { return this; }
   StmtList& Stmts() { return stmts_; }
   ::Scope* Scope() { return scope_; }
 
@@ -224,12 +309,15 @@ struct Initializer {
 };
 
 
-using InitList = std::set<Initializer>;
+// Ordered by offset, which is the order most initializers are added in
+using InitList = std::vector<Initializer>;
 
 class Declaration: public Stmt {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
 
 public:
   static Declaration* New(Object* obj);
@@ -238,6 +326,7 @@ public:
   InitList& Inits() { return inits_; }
   Object* Obj() { return obj_; }
   void AddInit(Initializer init);
+  void FinishInits();
 
 protected:
   Declaration(Object* obj): obj_(obj) {}
@@ -263,7 +352,11 @@ class Expr : public Stmt {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
   friend class LValGenerator;
+  friend class OperandGenerator;
+  friend class IRLValBuilder;
 
 public:
   virtual ~Expr() {}
@@ -279,6 +372,13 @@ public:
   static Expr* MayCast(Expr* expr);
   static Expr* MayCast(Expr* expr, QualType desType);
   virtual bool IsNullPointerConstant() const { return false; }
+  virtual Expr* ToExpr() { return this; }
+  virtual Constant* ToConstant() { return nullptr; }
+  virtual BinaryOp* ToBinaryOp() { return nullptr; }
+  virtual UnaryOp* ToUnaryOp() { return nullptr; }
+  virtual ConditionalOp* ToConditionalOp() { return nullptr; }
+  virtual FuncCall* ToFuncCall() { return nullptr; }
+  virtual Identifier* ToIdentifier() { return nullptr; }
   bool IsConstQualified() const { return type_.IsConstQualified(); }
   bool IsRestrictQualified() const { return type_.IsRestrictQualified(); }
   bool IsVolatileQualified() const { return type_.IsVolatileQualified(); }
@@ -305,7 +405,11 @@ class BinaryOp : public Expr {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
   friend class LValGenerator;
+  friend class OperandGenerator;
+  friend class IRLValBuilder;
   friend class Declaration;
 
 public:
@@ -313,6 +417,7 @@ public:
   static BinaryOp* New(const Token* tok, int op, Expr* lhs, Expr* rhs);
   virtual ~BinaryOp() {}
   virtual void Accept(Visitor* v);
+  virtual BinaryOp* ToBinaryOp() { return this; }
 
   // Member ref operator is a lvalue
   virtual bool IsLVal() {
@@ -369,12 +474,17 @@ class UnaryOp : public Expr {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
   friend class LValGenerator;
+  friend class OperandGenerator;
+  friend class IRLValBuilder;
 
 public:
   static UnaryOp* New(int op, Expr* operand, QualType type=nullptr);
   virtual ~UnaryOp() {}
   virtual void Accept(Visitor* v);
+  virtual UnaryOp* ToUnaryOp() { return this; }
   virtual bool IsLVal();
   ArithmType* Convert();
   void TypeChecking();
@@ -403,6 +513,9 @@ class ConditionalOp : public Expr {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
+  friend class OperandGenerator;
 
 public:
   static ConditionalOp* New(const Token* tok,
@@ -410,6 +523,7 @@ public:
   virtual ~ConditionalOp() {}
   virtual void Accept(Visitor* v);
   virtual bool IsLVal() { return false; }
+  virtual ConditionalOp* ToConditionalOp() { return this; }
   ArithmType* Convert();
   virtual void TypeChecking();
 
@@ -429,6 +543,8 @@ class FuncCall : public Expr {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
 
 public:
   using ArgList = std::vector<Expr*>;
@@ -440,6 +556,7 @@ public:
 
   // A function call is ofcourse not lvalue
   virtual bool IsLVal() { return false; }
+  virtual FuncCall* ToFuncCall() { return this; }
   ArgList* Args() { return &args_; }
   Expr* Designator() { return designator_; }
   const std::string& Name() const { return tok_->str_; }
@@ -460,6 +577,8 @@ class Constant: public Expr {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
 
 public:
   static Constant* New(const Token* tok, int tag, long val);
@@ -469,6 +588,7 @@ public:
   virtual void Accept(Visitor* v);
   virtual bool IsLVal() { return false; }
   virtual void TypeChecking() {}
+  virtual Constant* ToConstant() { return this; }
 
   long IVal() const { return ival_; }
   double FVal() const { return fval_; }
@@ -499,6 +619,8 @@ class TempVar : public Expr {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
 
 public:
   static TempVar* New(QualType type);
@@ -531,13 +653,18 @@ class Identifier: public Expr {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
   friend class LValGenerator;
+  friend class OperandGenerator;
+  friend class IRLValBuilder;
 
 public:
   static Identifier* New(const Token* tok, QualType type, Linkage linkage);
   virtual ~Identifier() {}
   virtual void Accept(Visitor* v);
   virtual bool IsLVal() { return false; }
+  virtual Identifier* ToIdentifier() { return this; }
   virtual Object* ToObject() { return nullptr; }
   virtual Enumerator* ToEnumerator() { return nullptr; }
 
@@ -568,6 +695,8 @@ class Enumerator: public Identifier {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
 
 public:
   static Enumerator* New(const Token* tok, int val);
@@ -589,7 +718,11 @@ class Object : public Identifier {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
   friend class LValGenerator;
+  friend class OperandGenerator;
+  friend class IRLValBuilder;
 
 public:
   static Object* New(const Token* tok,
@@ -692,6 +825,8 @@ class FuncDef : public ExtDecl {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
 
 public:
   using ParamList = std::vector<Object*>;
@@ -700,6 +835,7 @@ public:
   static FuncDef* New(Identifier* ident, LabelStmt* retLabel);
   virtual ~FuncDef() {}
   virtual void Accept(Visitor* v);
+  virtual FuncDef* ToFuncDef() { return this; }
   ::FuncType* FuncType() { return ident_->Type()->ToFunc(); }
   CompoundStmt* Body() { return body_; }
   void SetBody(CompoundStmt* body) { body_ = body; }
@@ -708,7 +844,7 @@ public:
 
 protected:
   FuncDef(Identifier* ident, LabelStmt* retLabel)
-      : ident_(ident), retLabel_(retLabel) {}
+      : ident_(ident), retLabel_(retLabel), body_(nullptr) {}
 
 private:
   Identifier* ident_;
@@ -723,6 +859,8 @@ class TranslationUnit : public ASTNode {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
   friend class Generator;
+  friend class IRBuilder;
+  friend class ConstantFolder;
 
 public:
   static TranslationUnit* New() { return new TranslationUnit();}
@@ -1,10 +1,14 @@
 #include "code_gen.h"
 
 #include "evaluator.h"
+#include "ir.h"
 #include "parser.h"
 #include "token.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstdarg>
+#include <functional>
 #include <queue>
 #include <set>
 
@@ -12,29 +16,49 @@
 extern std::string filename_in;
 extern std::string filename_out;
 extern bool debug;
+extern int optimize;
+extern bool omit_frame_pointer;
 
 const std::string* Generator::last_file = nullptr;
 Parser* Generator::parser_ = nullptr;
 FILE* Generator::outFile_ = nullptr;
 RODataList Generator::rodatas_;
+std::map<std::string, std::string> Generator::consLabels_;
 std::vector<Declaration*> Generator::staticDecls_;
 int Generator::offset_ = 0;
 int Generator::retAddrOffset_ = 0;
 FuncDef* Generator::curFunc_ = nullptr;
+InstList Generator::insts_;
+VRegList Generator::vregs_;
+std::vector<int> Generator::tempStack_;
+std::set<Object*> Generator::promoted_;
+std::map<Object*, int> Generator::localVRegs_;
+int Generator::prologueEnd_ = 0;
+int Generator::calleeSaveOffset_ = 0;
+std::map<int, int> Generator::volatileSlots_;
+std::set<std::string> Generator::volatileLabels_;
+std::map<std::string, FuncDef*> Generator::funcDefs_;
+std::set<FuncDef*> Generator::inlining_;
+std::string Generator::inlineExit_;
+std::string Generator::labelSuffix_;
+int Generator::raxZeroExt_ = 0;
+bool Generator::tailCalls_ = false;
+bool Generator::makesCalls_ = false;
+bool Generator::stackArgs_ = false;
+int Generator::raxSignExt_ = 0;
 
 
 /*
  * Register usage:
  *  xmm0: accumulator of floating datas;
- *  xmm8: temp register for param passing(xmm0)
  *  xmm9: source operand register;
- *  xmm10: tmp register for floating data swap;
  *  rax: accumulator;
- *  r12, r13: temp register for rdx and rcx
  *  r11: source operand register;
  *  r10: base register when LValGenerator eval the address.
- *  rcx: tempvar register, like the tempvar of 'switch'
+ *  rcx: tempvar register
  *       temp register for struct copy
+ *  rbx, r12-r15, xmm8, xmm10-xmm15: temporaries and locals allocated
+ *       with -O1
  */
 
 static std::vector<const char*> regs {
@@ -47,6 +71,87 @@ static std::vector<const char*> xregs {
   "%xmm4", "%xmm5", "%xmm6", "%xmm7"
 };
 
+// Registers the allocator may assign to virtual registers.
+// They are never used by the generated code otherwise.
+// Only the general purpose ones are preserved across calls.
+static std::vector<const char*> calleeSavedRegs {
+  "%rbx", "%r12", "%r13", "%r14", "%r15"
+};
+
+// Where a tail call restores the callee-saved registers
+static const std::string restoresMark = "\t# restores";
+
+static std::vector<const char*> tempXregs {
+  "%xmm8", "%xmm10", "%xmm11", "%xmm12",
+  "%xmm13", "%xmm14", "%xmm15"
+};
+
+
+// The low 'width' bytes of one of the calleeSavedRegs, or of %rbp
+static std::string RegOfWidth(const std::string& reg, int width) {
+  if (width == 8)
+    return reg;
+  if (reg == "%rbx")
+    return width == 1 ? "%bl": width == 2 ? "%bx": "%ebx";
+  if (reg == "%rbp")
+    return width == 1 ? "%bpl": width == 2 ? "%bp": "%ebp";
+  return reg + (width == 1 ? "b": width == 2 ? "w": "d");
+}
+
+
+// Replaces every frame slot 'N(%rbp)' named in 'inst' by f(N)
+static std::string MapSlots(const std::string& inst,
+                            std::function<std::string(int)> f) {
+  if (inst.compare(0, 2, "\t#") == 0)
+    return inst;
+  std::string ret;
+  size_t begin = 0, pos;
+  while ((pos = inst.find("(%rbp)", begin)) != std::string::npos) {
+    auto digits = pos;
+    while (digits > begin &&
+           (isdigit(inst[digits - 1]) || inst[digits - 1] == '-')) {
+      --digits;
+    }
+    auto num = inst.substr(digits, pos - digits);
+    ret += inst.substr(begin, digits - begin);
+    ret += f(num.size() ? std::stoi(num): 0);
+    begin = pos + 6;
+  }
+  return ret + inst.substr(begin);
+}
+
+
+// Adds 'delta' to the frame offsets in 'inst' that are below 'offset'
+static std::string ShiftFrame(const std::string& inst,
+                              int offset, int delta) {
+  return MapSlots(inst, [offset, delta](int slot) {
+    return std::to_string(slot < offset ? slot + delta: slot) + "(%rbp)";
+  });
+}
+
+
+// Replaces every virtual register named in 'inst' by f(index)
+static std::string MapVRegs(const std::string& inst,
+                            std::function<std::string(int)> f) {
+  // Comments may quote the source
+  if (inst.compare(0, 2, "\t#") == 0)
+    return inst;
+  std::string ret;
+  size_t begin = 0, pos;
+  while ((pos = inst.find("%v", begin)) != std::string::npos) {
+    auto end = pos + 2;
+    while (end < inst.size() && isdigit(inst[end]))
+      ++end;
+    ret += inst.substr(begin, pos - begin);
+    if (end == pos + 2)
+      ret += "%v";
+    else
+      ret += f(std::stoi(inst.substr(pos + 2, end - pos - 2)));
+    begin = end;
+  }
+  return ret + inst.substr(begin);
+}
+
 
 static ParamClass Classify(Type* paramType, int offset=0) {
   if (paramType->IsInteger() || paramType->ToPointer()
@@ -110,26 +215,147 @@ static ParamClass Classify(Type* paramType, int offset=0) {
 
 
 std::string Generator::ConsLabel(Constant* cons) {
-  if (cons->Type()->IsInteger()) {
+  if (cons->Type()->IsInteger())
     return "$" + std::to_string(cons->IVal());
-  } else if (cons->Type()->IsFloat()) {
+
+  // Equal literals share their label
+  std::string key;
+  long val = 0;
+  auto width = cons->Type()->Width();
+  if (cons->Type()->IsFloat()) {
     double valsd = cons->FVal();
     float  valss = valsd;
-    // TODO(wgtdkp): Add rodata
-    auto width = cons->Type()->Width();
-    long val = (width == 4)? *reinterpret_cast<int*>(&valss):
-                             *reinterpret_cast<long*>(&valsd);
-    const ROData& rodata = ROData(val, width);
-    rodatas_.push_back(rodata);
-    return rodata.label_;
-  } else { // Literal
-    const ROData& rodata = ROData(cons->SValRepr());
-    rodatas_.push_back(rodata);
-    return rodata.label_; // Return address
+    val = (width == 4)? *reinterpret_cast<int*>(&valss):
+                        *reinterpret_cast<long*>(&valsd);
+    key = std::to_string(width) + ":" + std::to_string(val);
+  } else {
+    key = "s:" + cons->SValRepr();
+  }
+  auto iter = consLabels_.find(key);
+  if (iter != consLabels_.end())
+    return iter->second;
+
+  if (cons->Type()->IsFloat())
+    rodatas_.push_back(ROData(val, width));
+  else
+    rodatas_.push_back(ROData(cons->SValRepr()));
+  consLabels_[key] = rodatas_.back().label_;
+  return rodatas_.back().label_; // Return address
+}
+
+
+// Floats compare as unsigned, ucomis sets CF and ZF
+static std::string CompCond(int op, bool flt, bool sign) {
+  bool below = flt || !sign;
+  switch (op) {
+  case '<': return below ? "b": "l";
+  case '>': return below ? "a": "g";
+  case Token::LE: return below ? "be": "le";
+  case Token::GE: return below ? "ae": "ge";
+  case Token::EQ: return "e";
+  case Token::NE: return "ne";
+  default: return "";
   }
 }
 
 
+// Empty if the condition is not known
+static std::string NegateCond(const std::string& cond) {
+  static const std::map<std::string, std::string> negations {
+    {"b", "ae"}, {"ae", "b"}, {"a", "be"}, {"be", "a"},
+    {"l", "ge"}, {"ge", "l"}, {"g", "le"}, {"le", "g"},
+    {"e", "ne"}, {"ne", "e"},
+  };
+  auto negation = negations.find(cond);
+  return negation == negations.end() ? "": negation->second;
+}
+
+
+// Power of two exponent of 'x', or -1
+static int Log2(unsigned long x) {
+  if (x == 0 || (x & (x - 1)))
+    return -1;
+  int k = 0;
+  while (x >>= 1)
+    ++k;
+  return k;
+}
+
+
+// Magic numbers for division by a constant, from Hacker's Delight,
+// chapter 10: q = mulhi(x, m) >> s for all 'bits' wide dividends.
+// 'add' means the unsigned multiplier needs bits + 1 bits,
+// of which 'm' holds the low part.
+struct Magic {
+  unsigned long m;
+  int s;
+  bool add;
+};
+
+
+// 2 <= d < 2^(bits - 1)
+static Magic SignedMagic(unsigned long d, int bits) {
+  auto mask = bits == 64 ? ~0UL: (1UL << bits) - 1;
+  auto two = 1UL << (bits - 1);
+  auto anc = two - 1 - two % d;
+  auto q1 = two / anc, r1 = two - q1 * anc;
+  auto q2 = two / d, r2 = two - q2 * d;
+  unsigned long delta;
+  int p = bits - 1;
+  do {
+    ++p;
+    q1 = (2 * q1) & mask;
+    r1 = (2 * r1) & mask;
+    if (r1 >= anc) {
+      ++q1;
+      r1 -= anc;
+    }
+    q2 = (2 * q2) & mask;
+    r2 = (2 * r2) & mask;
+    if (r2 >= d) {
+      ++q2;
+      r2 -= d;
+    }
+    delta = d - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+  return {(q2 + 1) & mask, p - bits, false};
+}
+
+
+// 2 <= d < 2^(bits - 1)
+static Magic UnsignedMagic(unsigned long d, int bits) {
+  auto mask = bits == 64 ? ~0UL: (1UL << bits) - 1;
+  auto two = 1UL << (bits - 1);
+  auto nc = mask - ((-d) & mask) % d;
+  auto q1 = two / nc, r1 = two - q1 * nc;
+  auto q2 = (two - 1) / d, r2 = (two - 1) - q2 * d;
+  unsigned long delta;
+  bool add = false;
+  int p = bits - 1;
+  do {
+    ++p;
+    if (r1 >= nc - r1) {
+      q1 = (2 * q1 + 1) & mask;
+      r1 = (2 * r1 - nc) & mask;
+    } else {
+      q1 = (2 * q1) & mask;
+      r1 = (2 * r1) & mask;
+    }
+    if (r2 + 1 >= d - r2) {
+      add = add || q2 >= two - 1;
+      q2 = (2 * q2 + 1) & mask;
+      r2 = (2 * r2 + 1 - d) & mask;
+    } else {
+      add = add || q2 >= two;
+      q2 = (2 * q2) & mask;
+      r2 = (2 * r2 + 1) & mask;
+    }
+    delta = d - 1 - r2;
+  } while (p < 2 * bits && (q1 < delta || (q1 == delta && r1 == 0)));
+  return {(q2 + 1) & mask, p - bits, add};
+}
+
+
 static const char* GetLoad(int width, bool flt=false) {
   switch (width) {
   case 1: return "movzbq";
@@ -228,8 +454,68 @@ int Generator::Pop(const std::string& reg) {
 }
 
 
+// Save the temporary in 'reg' until the paired PopTemp()
+void Generator::PushTemp(const std::string& reg) {
+  if (!optimize) {
+    Push(reg);
+    return;
+  }
+  offset_ -= 8;
+  int idx = vregs_.size();
+  vregs_.push_back({offset_, reg[1] == 'x', 8, -1, -1, ""});
+  tempStack_.push_back(idx);
+  auto mov = reg[1] == 'x' ? "movsd": "movq";
+  Emit(mov, reg, VRegName(idx));
+}
+
+
+void Generator::PopTemp(const std::string& reg) {
+  if (!optimize) {
+    Pop(reg);
+    return;
+  }
+  auto idx = tempStack_.back();
+  tempStack_.pop_back();
+  auto mov = reg[1] == 'x' ? "movsd": "movq";
+  Emit(mov, VRegName(idx), reg);
+  offset_ += 8;
+}
+
+
+int Generator::NewVReg(int offset, Type* type) {
+  vregs_.push_back({offset, type->IsFloat(), type->Width(), -1, -1, ""});
+  return vregs_.size() - 1;
+}
+
+
+/*
+ * The scalar locals whose slots the IR can promote: their address is
+ * never taken and they are only accessed as a whole.
+ * They live in virtual registers instead of the stack frame.
+ * Returns whether all the slots are promoted, then no pointer
+ * into the frame may exist.
+ */
+bool Generator::PromoteLocals(FuncDef* funcDef) {
+  auto irFunc = IRBuilder().Build(funcDef);
+  irFunc->Verify();
+  auto slots = irFunc->PromotableSlots();
+  bool all = true;
+  for (const auto& slot: irFunc->slots_) {
+    auto obj = slot.first;
+    // Aggregates are accessed by members and bit-fields
+    if (slots.count(slot.second) && obj->Type()->IsScalar() &&
+        !obj->Anonymous() && !obj->IsVolatileQualified()) {
+      promoted_.insert(obj);
+    } else {
+      all = false;
+    }
+  }
+  return all;
+}
+
+
 void Generator::Spill(bool flt) {
-  Push(flt ? "%xmm0": "%rax");
+  PushTemp(flt ? "%xmm0": "%rax");
 }
 
 
@@ -238,7 +524,7 @@ void Generator::Restore(bool flt) {
   const auto& des = GetDes(8, flt);
   const auto& inst = GetInst("mov", 8, flt);
   Emit(inst, des, src);
-  Pop(des);
+  PopTemp(des);
 }
 
 
@@ -270,8 +556,8 @@ void Generator::Save(bool flt) {
  * >= cmp, setle, movzbq
  * == cmp, sete, movzbq
  * != cmp, setne, movzbq
- * && GenAndOp
- * || GenOrOp
+ * && GenLogicalOp
+ * || GenLogicalOp
  * ]  GenSubScriptingOp
  * .  GenMemberRefOp
  */
@@ -281,10 +567,8 @@ void Generator::VisitBinaryOp(BinaryOp* binary) {
 
   if (op == '=')
     return GenAssignOp(binary);
-  if (op == Token::LOGICAL_AND)
-    return GenAndOp(binary);
-  if (op == Token::LOGICAL_OR)
-    return GenOrOp(binary);
+  if (op == Token::LOGICAL_AND || op == Token::LOGICAL_OR)
+    return GenLogicalOp(binary);
   if (op == '.')
     return GenMemberRefOp(binary);
   if (op == ',')
@@ -303,29 +587,16 @@ void Generator::VisitBinaryOp(BinaryOp* binary) {
   auto width = type->Width();
   auto flt = type->IsFloat();
   auto sign = !type->IsUnsigned();
-
-  Visit(binary->lhs_);
-  Spill(flt);
-  Visit(binary->rhs_);
-  Restore(flt);
+  auto src = GenOperands(binary);
+  auto cond = CompCond(op, flt, sign);
+  if (cond.size())
+    return GenCompOp(width, flt, ("set" + cond).c_str(), src);
 
   const char* inst = nullptr;
 
   switch (op) {
-  case '*': return GenMulOp(width, flt, sign);
-  case '/': case '%': return GenDivOp(flt, sign, width, op);
-  case '<':
-    return GenCompOp(width, flt, (flt || !sign) ? "setb": "setl");
-  case '>':
-    return GenCompOp(width, flt, (flt || !sign) ? "seta": "setg");
-  case Token::LE:
-    return GenCompOp(width, flt, (flt || !sign) ? "setbe": "setle");
-  case Token::GE:
-    return GenCompOp(width, flt, (flt || !sign) ? "setae": "setge");
-  case Token::EQ:
-    return GenCompOp(width, flt, "sete");
-  case Token::NE:
-    return GenCompOp(width, flt, "setne");
+  case '*': return GenMulOp(width, flt, src);
+  case '/': case '%': return GenDivOp(flt, sign, width, op, src);
 
   case '+': inst = "add"; break;
   case '-': inst = "sub"; break;
@@ -334,11 +605,68 @@ void Generator::VisitBinaryOp(BinaryOp* binary) {
   case '^': inst = "xor"; break;
   case Token::LEFT: case Token::RIGHT:
     inst = op == Token::LEFT ? "sal": (sign ? "sar": "shr");
-    Emit("movq %r11, %rcx");
-    Emit(GetInst(inst, width, flt), "%cl", GetDes(width, flt));
-    return;
+    if (src[0] != '$') {
+      if (src != GetSrc(width, flt))
+        Emit(GetInst("mov", width, flt), src, GetSrc(width, flt));
+      Emit("movq %r11, %rcx");
+      src = "%cl";
+    }
+    break;
+  }
+  Emit(GetInst(inst, width, flt), src, GetDes(width, flt));
+  // 32 bits operations clear the upper half
+  if (!flt && width == 4)
+    SetRaxExt(4, 0);
+}
+
+
+/*
+ * Loads the lhs of 'binary' to the accumulator and returns the source
+ * operand holding the rhs.
+ * The order of evaluation of the operands is unspecified.
+ * A simple rhs is used as the source operand directly, a simple lhs
+ * is loaded after the rhs. Otherwise, the operand that needs more
+ * registers is evaluated first.
+ */
+std::string Generator::GenOperands(BinaryOp* binary) {
+  auto type = binary->lhs_->Type();
+  auto width = type->Width();
+  auto flt = type->IsFloat();
+
+  auto src = OperandGenerator(width).GenExpr(binary->rhs_);
+  if (src.size()) {
+    Visit(binary->lhs_);
+    return src;
+  }
+  auto lhs = OperandGenerator(width).GenExpr(binary->lhs_);
+  if (lhs.size()) {
+    Visit(binary->rhs_);
+    Save(flt);
+    EmitLoadOperand(lhs, width, flt);
+  } else if (OperandGenerator::Need(binary->rhs_) >
+             OperandGenerator::Need(binary->lhs_)) {
+    Visit(binary->rhs_);
+    Spill(flt);
+    Visit(binary->lhs_);
+    PopTemp(GetSrc(8, flt));
+  } else {
+    Visit(binary->lhs_);
+    Spill(flt);
+    Visit(binary->rhs_);
+    Restore(flt);
+  }
+  return GetSrc(width, flt);
+}
+
+
+// Loads an operand selected by OperandGenerator to the accumulator
+void Generator::EmitLoadOperand(const std::string& operand,
+                                int width, bool flt) {
+  if (operand[0] == '$') {
+    Emit(GetInst("mov", width, flt), operand, GetDes(width, flt));
+  } else {
+    EmitLoad(operand, width, flt);
   }
-  Emit(GetInst(inst, width, flt), GetSrc(width, flt), GetDes(width, flt));
 }
 
 
@@ -348,14 +676,35 @@ void Generator::GenCommaOp(BinaryOp* comma) {
 }
 
 
-void Generator::GenMulOp(int width, bool flt, bool sign) {
-  auto inst = flt ? "mul": (sign ? "imul": "mul");
-
-  if (flt) {
-    Emit(GetInst(inst, width, flt), "%xmm9", "%xmm0");
-  } else {
-    Emit(GetInst(inst, width, flt), GetSrc(width, flt));
+// The low half of the product is the same for signed and unsigned.
+// Small constant factors are strength reduced to 'shl' and 'lea'.
+void Generator::GenMulOp(int width, bool flt, const std::string& src) {
+  if (!flt && src[0] == '$') {
+    auto imm = std::stol(src.substr(1));
+    auto reg = GetReg(width);
+    int k = 0;
+    for (; imm != 0 && imm % 2 == 0; imm /= 2)
+      ++k;
+    if (imm == 0) {
+      Emit("xorl", "%eax", "%eax");
+      return;
+    }
+    if (imm == 1 || imm == -1 || imm == 3 || imm == 5 || imm == 9) {
+      if (imm == 3 || imm == 5 || imm == 9) {
+        auto scale = std::to_string(imm - 1);
+        Emit(GetInst("lea", width, flt), "(%rax,%rax," + scale + ")", reg);
+      } else if (imm == -1) {
+        Emit(GetInst("neg", width, flt), reg);
+      }
+      if (k > 0)
+        Emit(GetInst("sal", width, flt), k, reg);
+      return;
+    }
   }
+  auto inst = flt ? "mul": "imul";
+  Emit(GetInst(inst, width, flt), src, GetDes(width, flt));
+  if (!flt && width == 4)
+    SetRaxExt(4, 0);
 }
 
 
@@ -373,45 +722,68 @@ void Generator::GenCompZero(Type* type) {
 }
 
 
-void Generator::GenAndOp(BinaryOp* andOp) {
-  VisitExpr(andOp->lhs_);
-  GenCompZero(andOp->lhs_->Type());
-
+void Generator::GenLogicalOp(BinaryOp* logicalOp) {
   auto labelFalse = LabelStmt::New();
-  Emit("je", labelFalse);
-
-  VisitExpr(andOp->rhs_);
-  GenCompZero(andOp->rhs_->Type());
-
-  Emit("je", labelFalse);
+  GenBranch(logicalOp, false, labelFalse);
 
   Emit("movq", "$1", "%rax");
-  auto labelTrue = LabelStmt::New();
-  Emit("jmp", labelTrue);
-  EmitLabel(labelFalse->Repr());
+  auto labelEnd = LabelStmt::New();
+  Emit("jmp", labelEnd);
+  EmitLabel(LabelRepr(labelFalse));
   Emit("xorq", "%rax", "%rax"); // Set %rax to 0
-  EmitLabel(labelTrue->Repr());
+  EmitLabel(LabelRepr(labelEnd));
 }
 
 
-void Generator::GenOrOp(BinaryOp* orOp) {
-  VisitExpr(orOp->lhs_);
-  GenCompZero(orOp->lhs_->Type());
+/*
+ * Jumps to 'label' if the value of 'expr' is 'when', falls through
+ * otherwise. Comparisons set the flags for the jump directly, and the
+ * operands of '&&' and '||' branch on their own.
+ */
+void Generator::GenBranch(Expr* expr, bool when, const LabelStmt* label) {
+  auto cons = expr->ToConstant();
+  if (cons && cons->Type()->IsInteger()) {
+    if ((cons->IVal() != 0) == when)
+      Emit("jmp", label);
+    return;
+  }
 
-  auto labelTrue = LabelStmt::New();
-  Emit("jne", labelTrue);
+  auto unary = expr->ToUnaryOp();
+  if (unary && unary->op_ == '!')
+    return GenBranch(unary->operand_, !when, label);
 
-  VisitExpr(orOp->rhs_);
-  GenCompZero(orOp->rhs_->Type());
+  auto binary = expr->ToBinaryOp();
+  auto op = binary ? binary->op_: 0;
+  if (op == Token::LOGICAL_AND || op == Token::LOGICAL_OR) {
+    // The value of the lhs that decides the result without the rhs
+    bool decisive = op == Token::LOGICAL_OR;
+    if (decisive == when) {
+      GenBranch(binary->lhs_, when, label);
+      GenBranch(binary->rhs_, when, label);
+    } else {
+      auto labelSkip = LabelStmt::New();
+      GenBranch(binary->lhs_, decisive, labelSkip);
+      GenBranch(binary->rhs_, when, label);
+      EmitLabel(LabelRepr(labelSkip));
+    }
+    return;
+  }
 
-  Emit("jne", labelTrue);
+  if (binary) {
+    auto type = binary->lhs_->Type();
+    auto flt = type->IsFloat();
+    auto cond = CompCond(op, flt, !type->IsUnsigned());
+    if (cond.size()) {
+      auto src = GenOperands(binary);
+      GenCmp(type->Width(), flt, src);
+      Emit("j" + (when ? cond: NegateCond(cond)), label);
+      return;
+    }
+  }
 
-  Emit("xorq", "%rax", "%rax"); // Set %rax to 0
-  auto labelFalse = LabelStmt::New();
-  Emit("jmp", labelFalse);
-  EmitLabel(labelTrue->Repr());
-  Emit("movq", "$1", "%rax");
-  EmitLabel(labelFalse->Repr());
+  VisitExpr(expr);
+  GenCompZero(expr->Type());
+  Emit(when ? "jne": "je", label);
 }
 
 
@@ -420,15 +792,15 @@ void Generator::GenMemberRefOp(BinaryOp* ref) {
   auto addr = LValGenerator().GenExpr(ref->lhs_);
   const auto& name = ref->rhs_->Tok()->str_;
   auto structType = ref->lhs_->Type()->ToStruct();
-  auto member = structType->GetMember(name);
+  auto field = structType->GetField(name);
 
-  addr.offset_ += member->Offset();
+  addr.offset_ += field->offset_;
 
   if (!ref->Type()->IsScalar()) {
     Emit("leaq", addr, "%rax");
   } else {
-    if (member->BitFieldWidth()) {
-      EmitLoadBitField(addr.Repr(), member);
+    if (field->bitFieldWidth_) {
+      EmitLoadBitField(addr.Repr(), field->member_);
     } else {
       EmitLoad(addr.Repr(), ref->Type());
     }
@@ -459,10 +831,10 @@ void Generator::GenAssignOp(BinaryOp* assign) {
   // Base register of static object maybe %rip
   // Visit rhs_ may changes r10
   if (addr.base_ == "%r10")
-    Push(addr.base_);
+    PushTemp(addr.base_);
   VisitExpr(assign->rhs_);
   if (addr.base_ == "%r10")
-    Pop(addr.base_);
+    PopTemp(addr.base_);
 
   if (assign->Type()->IsScalar()) {
       EmitStore(addr, assign->Type());
@@ -492,7 +864,50 @@ void Generator::EmitStoreBitField(const ObjectAddr& addr, Type* type) {
 }
 
 
+/*
+ * Block operations are tiered by size: moves of 8/4/2/1 bytes for small
+ * blocks, 16-byte sse moves up to 'blockSSELimit' bytes, the last one
+ * overlapping the previous when the width is not a multiple of 16,
+ * and 'rep movs/stos' beyond.
+ */
+static const int blockSSELimit = 128;
+
+static const char* const stringUnits[][2] = {
+  {"movsl", "stosl"}, {"movsw", "stosw"}, {"movsb", "stosb"}
+};
+
+
+// The rest of a block after 'rep movsq/stosq', with %rsi and %rdi advanced
+void Generator::EmitStringTail(int width, bool zero) {
+  int unit = 4;
+  for (auto inst: stringUnits) {
+    if (width & unit)
+      Emit(inst[zero]);
+    unit >>= 1;
+  }
+}
+
+
+// The address of the source is in %rax
 void Generator::CopyStruct(ObjectAddr desAddr, int width) {
+  if (width > blockSSELimit) {
+    Emit("leaq", desAddr, "%rdi");
+    Emit("movq", "%rax", "%rsi");
+    Emit("movl", width / 8, "%ecx");
+    Emit("rep movsq");
+    return EmitStringTail(width % 8, false);
+  } else if (width >= 16) {
+    ObjectAddr srcAddr = {"", "%rax", 0};
+    for (int offset = 0; offset < width; offset += 16) {
+      offset = std::min(offset, width - 16);
+      srcAddr.offset_ = offset;
+      Emit("movdqu", srcAddr, "%xmm9");
+      Emit("movdqu", "%xmm9",
+           ObjectAddr(desAddr.label_, desAddr.base_, desAddr.offset_ + offset));
+    }
+    return;
+  }
+
   int units[] = {8, 4, 2, 1};
   Emit("movq", "%rax", "%rcx");
   ObjectAddr srcAddr = {"", "%rcx", 0};
@@ -508,59 +923,208 @@ void Generator::CopyStruct(ObjectAddr desAddr, int width) {
 }
 
 
-void Generator::GenCompOp(int width, bool flt, const char* set) {
+void Generator::GenCmp(int width, bool flt, const std::string& src) {
   std::string cmp;
   if (flt) {
     cmp = width == 8 ? "ucomisd": "ucomiss";
   } else {
     cmp = GetInst("cmp", width, flt);
   }
+  Emit(cmp, src, GetDes(width, flt));
+}
 
-  Emit(cmp, GetSrc(width, flt), GetDes(width, flt));
+
+void Generator::GenCompOp(int width, bool flt, const char* set,
+                          const std::string& src) {
+  GenCmp(width, flt, src);
   Emit(set, "%al");
   Emit("movzbq", "%al", "%rax");
+  SetRaxExt(1, 1);
 }
 
 
-void Generator::GenDivOp(bool flt, bool sign, int width, int op) {
+void Generator::GenDivOp(bool flt, bool sign, int width, int op,
+                         const std::string& src) {
   if (flt) {
     auto inst = width == 4 ? "divss": "divsd";
-    Emit(inst, "%xmm9", "%xmm0");
+    Emit(inst, src, "%xmm0");
+    return;
+  }
+  if (src[0] == '$' && GenDivImm(sign, width, op, std::stol(src.substr(1))))
     return;
+  // Division has no immediate form
+  auto divisor = src;
+  if (divisor[0] == '$') {
+    divisor = GetSrc(width, flt);
+    Emit(GetInst("mov", width, flt), src, divisor);
   }
   if (!sign) {
     Emit("xor", "%rdx", "%rdx");
-    Emit(GetInst("div", width, flt), GetSrc(width, flt));
+    Emit(GetInst("div", width, flt), divisor);
   } else {
     Emit(width == 4 ? "cltd": "cqto");
-    Emit(GetInst("idiv", width, flt), GetSrc(width, flt));
+    Emit(GetInst("idiv", width, flt), divisor);
   }
   if (op == '%')
     Emit("movq", "%rdx", "%rax");
 }
 
 
+// Division by a constant: powers of two become shifts and masks,
+// other divisors a multiply by the magic reciprocal. The dividend
+// is kept in %rcx, %rdx and %r11 are scratch. Returns false if
+// the divisor is left to 'div'.
+bool Generator::GenDivImm(bool sign, int width, int op, long imm) {
+  int bits = width * 8;
+  auto mask = bits == 64 ? ~0UL: (1UL << bits) - 1;
+  auto top = 1UL << (bits - 1);
+  bool neg = sign && imm < 0;
+  unsigned long d = (neg ? -imm: imm) & mask;
+  int k = Log2(d);
+  if (d == 0 || (d >= top && (sign || k < 0)))
+    return false;
+
+  auto reg = GetReg(width);
+  auto cx = width == 8 ? "%rcx": "%ecx";
+  auto dx = width == 8 ? "%rdx": "%edx";
+  auto mov = GetInst("mov", width, false);
+  auto sar = GetInst("sar", width, false);
+  auto shr = GetInst("shr", width, false);
+  auto add = GetInst("add", width, false);
+  if (d == 1) {
+    if (op == '%')
+      Emit("xorl", "%eax", "%eax");
+    else if (neg)
+      Emit(GetInst("neg", width, false), reg);
+    return true;
+  }
+  if (k > 0 && !sign) {
+    if (op == '/') {
+      Emit(shr, k, reg);
+    } else if (k < 32) {
+      Emit(GetInst("and", width, false), (1L << k) - 1, reg);
+    } else {
+      Emit(GetInst("sal", width, false), bits - k, reg);
+      Emit(shr, bits - k, reg);
+    }
+    return true;
+  }
+
+  if (op == '%')
+    Emit(mov, reg, cx);
+  if (k > 0) {
+    // Negative dividends are biased by d - 1 to round towards zero
+    Emit(mov, reg, dx);
+    Emit(sar, bits - 1, dx);
+    Emit(shr, bits - k, dx);
+    Emit(add, dx, reg);
+    if (op == '%' && k < 32) {
+      Emit(GetInst("and", width, false), -(1L << k), reg);
+    } else {
+      Emit(sar, k, reg);
+      if (op == '%')
+        Emit(GetInst("sal", width, false), k, reg);
+    }
+  } else {
+    auto magic = sign ? SignedMagic(d, bits): UnsignedMagic(d, bits);
+    if (op == '/')
+      Emit(mov, reg, cx);
+    if (width == 4) {
+      // The 64 bits product holds the high half
+      if (sign) {
+        EmitExtend(4, true);
+        Emit("imulq", "$" + std::to_string(static_cast<int>(magic.m)), "%rax");
+        Emit("sarq", 32, "%rax");
+      } else {
+        Emit("movl", "$" + std::to_string(magic.m), "%eax");
+        Emit("imulq", "%rcx", "%rax");
+        Emit("shrq", 32, "%rax");
+      }
+    } else {
+      Emit("movabsq", "$" + std::to_string(static_cast<long>(magic.m)), "%r11");
+      Emit(sign ? "imulq": "mulq", "%r11");
+      Emit("movq", "%rdx", "%rax");
+    }
+    if (magic.add) {
+      Emit(mov, cx, dx);
+      Emit(GetInst("sub", width, false), reg, dx);
+      Emit(shr, 1, dx);
+      Emit(add, dx, reg);
+      if (magic.s > 1)
+        Emit(shr, magic.s - 1, reg);
+    } else if (sign) {
+      if (magic.m & top)
+        Emit(add, cx, reg);
+      if (magic.s > 0)
+        Emit(sar, magic.s, reg);
+      Emit(mov, cx, dx);
+      Emit(shr, bits - 1, dx);
+      Emit(add, dx, reg);
+    } else if (magic.s > 0) {
+      Emit(shr, magic.s, reg);
+    }
+    if (op == '%')
+      Emit(GetInst("imul", width, false), static_cast<int>(d), reg);
+  }
+
+  if (op == '%') {
+    Emit(GetInst("sub", width, false), reg, cx);
+    Emit(mov, cx, reg);
+  } else if (neg) {
+    Emit(GetInst("neg", width, false), reg);
+  }
+  return true;
+}
+
+
 void Generator::GenPointerArithm(BinaryOp* binary) {
   assert(binary->op_ == '+' || binary->op_ == '-');
   // For '+', we have swapped lhs_ and rhs_ to ensure that
   // the pointer is at lhs.
-  Visit(binary->lhs_);
-  Spill(false);
-  Visit(binary->rhs_);
-  Restore(false);
-
   auto type = binary->lhs_->Type()->ToPointer()->Derived();
-  auto width = type->Width();
-  if (binary->op_ == '+') {
+  long width = type->Width();
+  bool diff = binary->rhs_->Type()->ToPointer();
+  auto src = OperandGenerator(8).GenExpr(binary->rhs_);
+
+  // Constant offsets are folded into the displacement of a 'lea'
+  if (!diff && src[0] == '$') {
+    auto disp = std::stol(src.substr(1)) * width;
+    if (binary->op_ == '-')
+      disp = -disp;
+    if (disp == static_cast<int>(disp)) {
+      Visit(binary->lhs_);
+      if (disp != 0)
+        Emit("leaq", std::to_string(disp) + "(%rax)", "%rax");
+      return;
+    }
+  }
+
+  if (src.size()) {
+    Visit(binary->lhs_);
+    Emit("movq", src, "%r11");
+  } else {
+    Visit(binary->lhs_);
+    Spill(false);
+    Visit(binary->rhs_);
+    if (!diff)
+      EmitExtend(binary->rhs_->Type()->Width(),
+                 !binary->rhs_->Type()->IsUnsigned());
+    Restore(false);
+  }
+
+  if (diff) {
+    Emit("subq", "%r11", "%rax");
+    if (width > 1)
+      GenDivOp(false, true, 8, '/', "$" + std::to_string(width));
+  } else if (binary->op_ == '-') {
     if (width > 1)
       Emit("imulq", width, "%r11");
-    Emit("addq", "%r11", "%rax");
-  } else {
     Emit("subq", "%r11", "%rax");
-    if (width > 1) {
-      Emit("movq", width, "%r11");
-      GenDivOp(false, true, 8, '/');
-    }
+  } else if (width == 1 || width == 2 || width == 4 || width == 8) {
+    Emit("leaq", "(%rax,%r11," + std::to_string(width) + ")", "%rax");
+  } else {
+    Emit("imulq", width, "%r11");
+    Emit("addq", "%r11", "%rax");
   }
 }
 
@@ -592,12 +1156,13 @@ void Generator::GenCastOp(UnaryOp* cast) {
     // Handle bool
     if (desType->IsBool()) {
       Emit("pxor", "%xmm9", "%xmm9");
-      GenCompOp(srcType->Width(), true, "setne");
+      GenCompOp(srcType->Width(), true, "setne", "%xmm9");
     } else {
       auto inst = srcType->Width() == 4 ? "cvttss2si": "cvttsd2si";
       Emit(inst, "%xmm0", "%rax");
     }
   } else if (desType->IsFloat()) {
+    EmitExtend(srcType->Width(), !srcType->IsUnsigned());
     auto inst = desType->Width() == 4 ? "cvtsi2ss": "cvtsi2sd";
     Emit(inst, "%rax", "%xmm0");
   } else if (srcType->ToPointer()
@@ -609,29 +1174,15 @@ void Generator::GenCastOp(UnaryOp* cast) {
       Emit("setne", "%al");
     }
   } else {
+    // Only the low bytes of the type of a value are significant,
+    // a narrowing conversion needs no instruction
     assert(srcType->ToArithm());
     int width = srcType->Width();
-    auto sign = !srcType->IsUnsigned();
-    const char* inst;
-    switch (width) {
-    case 1:
-      inst = sign ? "movsbq": "movzbq";
-      Emit(inst, GetReg(width), "%rax");
-      break;
-    case 2:
-      inst = sign ? "movswq": "movzwq";
-      Emit(inst, GetReg(width), "%rax");
-      break;
-    case 4: inst = "movl";
-      if (desType->Width() == 8)
-        Emit("cltq");
-      break;
-    case 8: break;
-    }
-    // Handle bool
     if (desType->IsBool()) {
-      Emit("testq", "%rax", "%rax");
+      Emit(GetInst("test", width, false), GetReg(width), GetReg(width));
       Emit("setne", "%al");
+    } else if (desType->Width() > width) {
+      EmitExtend(width, !srcType->IsUnsigned());
     }
   }
 }
@@ -666,6 +1217,7 @@ void Generator::VisitUnaryOp(UnaryOp* unary) {
     GenCompZero(unary->operand_->Type());
     Emit("sete", "%al");
     Emit("movzbl", "%al", "%eax"); // Type of !operator is int
+    SetRaxExt(1, 1);
     return;
   case Token::CAST:
     Visit(unary->operand_);
@@ -694,9 +1246,10 @@ void Generator::GenMinusOp(UnaryOp* minus) {
   VisitExpr(minus->operand_);
 
   if (flt) {
-    Emit("pxor", "%xmm9", "%xmm9");
-    Emit(GetInst("sub", width, flt), "%xmm0", "%xmm9");
-    Emit(GetInst("mov", width, flt), "%xmm9", "%xmm0");
+    // Flip the sign bit, as 0 - 0.0 is not -0.0
+    Emit("movq", width == 4 ? "$0x80000000": "$0x8000000000000000", "%r11");
+    Emit("movq", "%r11", "%xmm9");
+    Emit("xorpd", "%xmm9", "%xmm0");
   } else {
     Emit(GetInst("neg", width, flt), GetDes(width, flt));
   }
@@ -732,7 +1285,7 @@ void Generator::GenIncDec(Expr* operand,
   if (postfix && flt) {
     Emit("movsd", "%xmm9", "%xmm0");
   } else if (postfix) {
-    Emit("mov", "%r11", "%rax");
+    Emit("movq", "%r11", "%rax");
   }
 }
 
@@ -761,13 +1314,17 @@ void Generator::VisitIdentifier(Identifier* ident) {
 
 void Generator::VisitConstant(Constant* cons) {
   EmitLoc(cons);
+  auto flt = cons->Type()->IsFloat();
+  if (flt && cons->FVal() == 0 && !std::signbit(cons->FVal())) {
+    Emit("pxor", "%xmm0", "%xmm0");
+    return;
+  }
   auto label = ConsLabel(cons);
 
   if (!cons->Type()->IsScalar()) {
     Emit("leaq", label, "%rax");
   } else {
     auto width = cons->Type()->Width();
-    auto flt = cons->Type()->IsFloat();
     auto load = GetInst("mov", width, flt);
     auto des = GetDes(width, flt);
     Emit(load, label, des);
@@ -796,12 +1353,36 @@ void Generator::VisitDeclaration(Declaration* decl) {
     if (!obj->HasInit())
       return;
 
+    if (localVRegs_.count(obj)) {
+      auto reg = VRegName(localVRegs_[obj]);
+      for (const auto& init: decl->Inits()) {
+        VisitExpr(init.expr_);
+        EmitStore(reg, init.type_);
+      }
+      return;
+    }
+
+    // Several gaps between the initializers are zeroed by a single fill
+    auto objEnd = obj->Offset() + obj->Type()->Width();
     int lastEnd = obj->Offset();
+    int gaps = 0;
+    for (const auto& init: decl->Inits()) {
+      gaps += obj->Offset() + init.offset_ > lastEnd;
+      lastEnd = std::max(lastEnd, obj->Offset() + init.offset_ +
+                                  init.type_->Width());
+    }
+    gaps += objEnd > lastEnd;
+    lastEnd = obj->Offset();
+    if (gaps > 1) {
+      EmitZero(ObjectAddr(lastEnd), objEnd - lastEnd);
+      lastEnd = objEnd;
+    }
+
     for (const auto& init: decl->Inits()) {
       ObjectAddr addr = ObjectAddr(obj->Offset() + init.offset_);
       addr.bitFieldBegin_ = init.bitFieldBegin_;
       addr.bitFieldWidth_ = init.bitFieldWidth_;
-      if (lastEnd != addr.offset_)
+      if (lastEnd < addr.offset_)
         EmitZero(ObjectAddr(lastEnd), addr.offset_ - lastEnd);
       VisitExpr(init.expr_);
       if (init.type_->IsScalar()) {
@@ -811,14 +1392,16 @@ void Generator::VisitDeclaration(Declaration* decl) {
       } else {
         assert(false);
       }
-      lastEnd = addr.offset_ + init.type_->Width();
+      lastEnd = std::max(lastEnd, addr.offset_ + init.type_->Width());
     }
-    auto objEnd = obj->Offset() + obj->Type()->Width();
-    if (lastEnd != objEnd)
+    if (lastEnd < objEnd)
       EmitZero(ObjectAddr(lastEnd), objEnd - lastEnd);
     return;
   }
 
+  // Emitted with the function itself
+  if (inlineExit_.size())
+    return;
   if (obj->Linkage() == L_NONE)
     staticDecls_.push_back(decl);
   else
@@ -826,6 +1409,36 @@ void Generator::VisitDeclaration(Declaration* decl) {
 }
 
 
+// Whether the object is never written; arrays are if their elements are
+static bool IsReadOnly(Object* obj) {
+  if (obj->IsConstQualified())
+    return true;
+  for (auto arr = obj->Type()->ToArray(); arr;) {
+    auto elem = arr->Derived();
+    if (elem.IsConstQualified())
+      return true;
+    arr = elem->ToArray();
+  }
+  return false;
+}
+
+
+// The bytes as a string of '.ascii'
+static std::string AsciiRepr(const std::string& bytes) {
+  std::string ret = "\"";
+  for (unsigned char c: bytes) {
+    if (c == '"' || c == '\\' || !isprint(c)) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\%03o", c);
+      ret += buf;
+    } else {
+      ret += c;
+    }
+  }
+  return ret + "\"";
+}
+
+
 void Generator::GenStaticDecl(Declaration* decl) {
   auto obj = decl->obj_;
   assert(obj->IsStatic());
@@ -838,7 +1451,55 @@ void Generator::GenStaticDecl(Declaration* decl) {
   if ((obj->Storage() & S_EXTERN) && !obj->HasInit())
     return;
 
-  Emit(".data");
+  // The chunks of a string initializer of byte arrays are split in bytes
+  auto type = obj->Type();
+  while (type->ToArray())
+    type = type->ToArray()->Derived().GetPtr();
+  bool bytes = obj->Type()->ToArray() && type->Width() == 1;
+
+  // Runs of equal initializers, 'width_' is that of one of them
+  StaticInitList runs;
+  std::vector<int> counts;
+  auto add = [&runs, &counts](const StaticInitializer& init) {
+    if (runs.size()) {
+      auto& last = runs.back();
+      if (last.offset_ + last.width_ * counts.back() == init.offset_ &&
+          last.width_ == init.width_ && last.val_ == init.val_ &&
+          last.label_.empty() && init.label_.empty()) {
+        ++counts.back();
+        return;
+      }
+    }
+    runs.push_back(init);
+    counts.push_back(1);
+  };
+
+  bool zero = true, reloc = false;
+  int offset = 0;
+  auto iter = decl->Inits().begin();
+  for (; iter != decl->Inits().end();) {
+    auto staticInit = GetStaticInit(iter,
+        decl->Inits().end(), std::max(iter->offset_, offset));
+    offset = staticInit.offset_ + staticInit.width_;
+    zero = zero && staticInit.val_ == 0 && staticInit.label_.empty();
+    reloc = reloc || staticInit.label_.size();
+    if (bytes && staticInit.label_.empty()) {
+      for (int i = 0; i < staticInit.width_; ++i) {
+        auto byte = (staticInit.val_ >> (i * 8)) & 0xff;
+        add({staticInit.offset_ + i, 1, byte, ""});
+      }
+    } else {
+      add(staticInit);
+    }
+  }
+
+  // Relocated pointers are written by the dynamic loader
+  if (IsReadOnly(obj))
+    Emit(".section", reloc ? ".data.rel.ro,\"aw\"": ".rodata");
+  else if (obj->HasInit() && zero)
+    Emit(".bss");
+  else
+    Emit(".data");
   auto glb = obj->Linkage() == L_EXTERNAL ? ".globl": ".local";
   Emit(glb, label);
 
@@ -854,43 +1515,85 @@ void Generator::GenStaticDecl(Declaration* decl) {
   Emit(".size", label, std::to_string(width));
   EmitLabel(label);
 
-  int offset = 0;
-  auto iter = decl->Inits().begin();
-  for (; iter != decl->Inits().end();) {
-    auto staticInit = GetStaticInit(iter,
-        decl->Inits().end(), std::max(iter->offset_, offset));
-
-    if (staticInit.offset_ > offset)
-      Emit(".zero", std::to_string(staticInit.offset_ - offset));
-
-    switch (staticInit.width_) {
-    case 1:
-      Emit(".byte", std::to_string(static_cast<char>(staticInit.val_)));
-      break;
-    case 2:
-      Emit(".value", std::to_string(static_cast<short>(staticInit.val_)));
-      break;
-    case 4:
-      Emit(".long", std::to_string(static_cast<int>(staticInit.val_)));
-      break;
-    case 8: {
-      std::string val;
-      if (staticInit.label_.size() == 0) {
-        val = std::to_string(staticInit.val_);
-      } else if (staticInit.val_ != 0) {
-        val = staticInit.label_ + "+" + std::to_string(staticInit.val_);
-      } else {
-        val = staticInit.label_;
-      }
-      Emit(".quad", val);
-    } break;
-    default: assert(false);
+  // Zeros are emitted together, short runs of bytes are gathered
+  // in '.ascii' blobs, the other runs are filled with their value
+  static const int minFill = 8;
+  int zeros = 0;
+  std::string ascii;
+  auto flush = [this, &zeros, &ascii]() {
+    if (ascii.size() && zeros < minFill) {
+      ascii.append(zeros, '\0');
+      zeros = 0;
+    }
+    if (ascii.size())
+      Emit(".ascii", AsciiRepr(ascii));
+    if (zeros)
+      Emit(".zero", std::to_string(zeros));
+    ascii.clear();
+    zeros = 0;
+  };
+  offset = 0;
+  for (size_t i = 0; i < runs.size(); ++i) {
+    const auto& run = runs[i];
+    auto count = counts[i];
+    zeros += run.offset_ - offset;
+    offset = run.offset_ + run.width_ * count;
+
+    unsigned long val = run.val_;
+    if (run.width_ < 8)
+      val &= (1UL << (run.width_ * 8)) - 1;
+    if (run.val_ == 0 && run.label_.empty()) {
+      zeros += run.width_ * count;
+      continue;
+    }
+    if (run.width_ == 1 && count < minFill) {
+      // Short runs of zeros between bytes join the blob
+      if (zeros >= minFill)
+        flush();
+      ascii.append(zeros, '\0');
+      ascii.append(count, static_cast<char>(val));
+      zeros = 0;
+      continue;
+    }
+    flush();
+    if (count > 1 && (val >> 32) == 0) {
+      // The value of '.fill' is at most 4 bytes
+      Emit(".fill", std::to_string(count) + ", " +
+                    std::to_string(run.width_) + ", " + std::to_string(val));
+    } else {
+      for (; count > 0; --count)
+        EmitStaticInit(run);
     }
-    offset = staticInit.offset_ + staticInit.width_;
   }
-  // Decides the size of object
-  if (width > offset)
-    Emit(".zero", std::to_string(width - offset));
+  zeros += std::max(width - offset, 0);
+  flush();
+}
+
+
+void Generator::EmitStaticInit(const StaticInitializer& staticInit) {
+  switch (staticInit.width_) {
+  case 1:
+    Emit(".byte", std::to_string(static_cast<char>(staticInit.val_)));
+    break;
+  case 2:
+    Emit(".value", std::to_string(static_cast<short>(staticInit.val_)));
+    break;
+  case 4:
+    Emit(".long", std::to_string(static_cast<int>(staticInit.val_)));
+    break;
+  case 8: {
+    std::string val;
+    if (staticInit.label_.size() == 0) {
+      val = std::to_string(staticInit.val_);
+    } else if (staticInit.val_ != 0) {
+      val = staticInit.label_ + "+" + std::to_string(staticInit.val_);
+    } else {
+      val = staticInit.label_;
+    }
+    Emit(".quad", val);
+  } break;
+  default: assert(false);
+  }
 }
 
 
@@ -900,44 +1603,405 @@ void Generator::VisitEmptyStmt(EmptyStmt* emptyStmt) {
 
 
 void Generator::VisitIfStmt(IfStmt* ifStmt) {
-  VisitExpr(ifStmt->cond_);
+  // A branch that is a jump becomes the target of the conditional jump
+  auto jumpThen = ifStmt->then_->ToJumpStmt();
+  auto jumpElse = ifStmt->else_ ? ifStmt->else_->ToJumpStmt(): nullptr;
+  if (jumpThen) {
+    GenBranch(ifStmt->cond_, true, jumpThen->label_);
+    if (ifStmt->else_)
+      VisitStmt(ifStmt->else_);
+    return;
+  } else if (jumpElse) {
+    GenBranch(ifStmt->cond_, false, jumpElse->label_);
+    VisitStmt(ifStmt->then_);
+    return;
+  }
 
-  // Compare to 0
   auto elseLabel = LabelStmt::New();
   auto endLabel = LabelStmt::New();
-
-  GenCompZero(ifStmt->cond_->Type());
-
-  if (ifStmt->else_) {
-    Emit("je", elseLabel);
-  } else {
-    Emit("je", endLabel);
-  }
+  GenBranch(ifStmt->cond_, false, ifStmt->else_ ? elseLabel: endLabel);
 
   VisitStmt(ifStmt->then_);
 
   if (ifStmt->else_) {
     Emit("jmp", endLabel);
-    EmitLabel(elseLabel->Repr());
+    EmitLabel(LabelRepr(elseLabel));
     VisitStmt(ifStmt->else_);
   }
 
-  EmitLabel(endLabel->Repr());
+  EmitLabel(LabelRepr(endLabel));
 }
 
 
-void Generator::VisitJumpStmt(JumpStmt* jumpStmt) {
-  Emit("jmp", jumpStmt->label_);
+/*
+ * Dense cases dispatch through a table in .rodata, sparse cases through
+ * a binary search over the sorted values.
+ */
+void Generator::VisitSwitchStmt(SwitchStmt* switchStmt) {
+  VisitExpr(switchStmt->cond_);
+
+  auto type = switchStmt->cond_->Type();
+  auto width = type->Width();
+  bool sign = !type->IsUnsigned();
+  auto cases = switchStmt->cases_;
+  std::sort(cases.begin(), cases.end(),
+            [sign](const CaseList::value_type& lhs,
+                   const CaseList::value_type& rhs) {
+    if (sign)
+      return lhs.first < rhs.first;
+    return static_cast<unsigned long>(lhs.first) <
+           static_cast<unsigned long>(rhs.first);
+  });
+
+  if (cases.size() < 4) {
+    GenCaseTree(cases, 0, cases.size(), width, sign, switchStmt->default_);
+    return;
+  }
+  auto low = cases.front().first;
+  auto range = static_cast<unsigned long>(cases.back().first - low) + 1;
+  if (range > 3 * cases.size()) {
+    GenCaseTree(cases, 0, cases.size(), width, sign, switchStmt->default_);
+    return;
+  }
+
+  // Values below 'low' wrap around and fail the unsigned bound check
+  std::vector<std::string> table(range, LabelRepr(switchStmt->default_));
+  for (const auto& item: cases)
+    table[item.first - low] = LabelRepr(item.second);
+  ROData rodata(table);
+  rodatas_.push_back(rodata);
+
+  auto reg = width == 8 ? "%rax": "%eax";
+  auto suffix = width == 8 ? "q": "l";
+  // The index of the table is 64 bits
+  if (low != 0)
+    Emit(std::string("sub") + suffix, "$" + std::to_string(low), reg);
+  else if (width == 4)
+    EmitExtend(4, false);
+  Emit(std::string("cmp") + suffix, "$" + std::to_string(range - 1), reg);
+  Emit("ja", switchStmt->default_);
+  Emit("leaq", rodata.label_ + "(%rip)", "%r11");
+  Emit("movslq", "(%r11,%rax,4)", "%rax");
+  Emit("addq", "%r11", "%rax");
+  Emit("jmp", "*%rax");
+}
+
+
+void Generator::GenCaseTree(const CaseList& cases, size_t begin, size_t end,
+                            int width, bool sign,
+                            const LabelStmt* defaultLabel) {
+  auto reg = width == 8 ? "%rax": "%eax";
+  auto cmp = width == 8 ? "cmpq": "cmpl";
+  if (end - begin <= 3) {
+    for (auto i = begin; i < end; ++i) {
+      Emit(cmp, "$" + std::to_string(cases[i].first), reg);
+      Emit("je", cases[i].second);
+    }
+    Emit("jmp", defaultLabel);
+    return;
+  }
+
+  auto mid = (begin + end) / 2;
+  auto lessLabel = LabelStmt::New();
+  Emit(cmp, "$" + std::to_string(cases[mid].first), reg);
+  Emit("je", cases[mid].second);
+  Emit(sign ? "jl": "jb", lessLabel);
+  GenCaseTree(cases, mid + 1, end, width, sign, defaultLabel);
+  EmitLabel(LabelRepr(lessLabel));
+  GenCaseTree(cases, begin, mid, width, sign, defaultLabel);
 }
 
 
-void Generator::VisitLabelStmt(LabelStmt* labelStmt) {
-  EmitLabel(labelStmt->Repr());
+/*
+ * Loops are rotated: the condition guards the entry and is tested again
+ * at the bottom, so each iteration takes a single backward branch.
+ */
+void Generator::VisitLoopStmt(LoopStmt* loopStmt) {
+  if (optimize)
+    GenVectorLoop(loopStmt);
+
+  auto cond = loopStmt->cond_;
+  if (cond && !loopStmt->doWhile_)
+    GenBranch(cond, false, loopStmt->break_);
+
+  // 'do {} while (0)' does not loop
+  auto cons = cond ? cond->ToConstant(): nullptr;
+  auto topLabel = LabelStmt::New();
+  if (optimize && !(cons && cons->Type()->IsInteger() && cons->IVal() == 0))
+    Emit(".p2align", "4,,10");
+  EmitLabel(LabelRepr(topLabel));
+  VisitStmt(loopStmt->body_);
+
+  EmitLabel(LabelRepr(loopStmt->continue_));
+  if (loopStmt->step_)
+    VisitStmt(loopStmt->step_);
+  if (cond)
+    GenBranch(cond, true, topLabel);
+  else
+    Emit("jmp", topLabel);
+  EmitLabel(LabelRepr(loopStmt->break_));
 }
 
 
-void Generator::VisitReturnStmt(ReturnStmt* returnStmt) {
+// The object 'expr' names, or null
+static Object* AsObject(Expr* expr) {
+  auto ident = expr->ToIdentifier();
+  return ident ? ident->ToObject(): nullptr;
+}
+
+
+// A signed 32 bits integer, which never wraps in 64 bits arithmetic
+static bool IsVectorIndex(Type* type) {
+  return type->IsInteger() && type->Width() == 4 && !type->IsUnsigned();
+}
+
+
+// The packed instructions on the elements of 'type'
+static const char* PackedInst(Type* type, int op) {
+  static const std::map<int, const char*> ints {
+    {'+', "paddd"}, {'-', "psubd"}, {'&', "pand"}, {'|', "por"}, {'^', "pxor"}
+  };
+  static const std::map<int, const char*> longs {
+    {'+', "paddq"}, {'-', "psubq"}, {'&', "pand"}, {'|', "por"}, {'^', "pxor"}
+  };
+  static const std::map<int, const char*> floats {
+    {'+', "addps"}, {'-', "subps"}, {'*', "mulps"}, {'/', "divps"},
+    {'=', "movups"}, {'c', "movaps"}
+  };
+  static const std::map<int, const char*> doubles {
+    {'+', "addpd"}, {'-', "subpd"}, {'*', "mulpd"}, {'/', "divpd"},
+    {'=', "movupd"}, {'c', "movapd"}
+  };
+  // Moves of the elements, and copies of the registers
+  if (!type->IsFloat() && (op == '=' || op == 'c'))
+    return op == '=' ? "movdqu": "movdqa";
+  const auto& insts = type->IsFloat() ?
+      (type->Width() == 4 ? floats: doubles):
+      (type->Width() == 4 ? ints: longs);
+  auto iter = insts.find(op);
+  return iter == insts.end() ? nullptr: iter->second;
+}
+
+
+// The array 'a' of the element 'a[index]', or null
+Object* Generator::VectorArray(Expr* expr, Object* index) {
+  auto deref = expr->ToUnaryOp();
+  if (!deref || deref->op_ != Token::DEREF || expr->IsVolatileQualified())
+    return nullptr;
+  auto add = deref->operand_->ToBinaryOp();
+  if (!add || add->op_ != '+' || AsObject(add->rhs_) != index)
+    return nullptr;
+  auto ptr = add->lhs_;
+  auto cast = ptr->ToUnaryOp();
+  if (cast && cast->op_ == Token::CAST && cast->operand_->Type()->ToArray())
+    ptr = cast->operand_;
+  // Pointers in virtual registers are not written through the arrays
+  auto array = AsObject(ptr);
+  if (!array || array->IsVolatileQualified() ||
+      !(array->Type()->ToArray() || localVRegs_.count(array))) {
+    return nullptr;
+  }
+  return array;
+}
+
+
+// Whether 'expr' is '++obj', 'obj++' or 'obj = obj + 1'
+bool Generator::IsIncrement(Expr* expr, Object* obj) {
+  auto unary = expr->ToUnaryOp();
+  if (unary) {
+    return (unary->op_ == Token::PREFIX_INC ||
+            unary->op_ == Token::POSTFIX_INC) &&
+           AsObject(unary->operand_) == obj;
+  }
+  auto assign = expr->ToBinaryOp();
+  if (!assign || assign->op_ != '=' || AsObject(assign->lhs_) != obj)
+    return false;
+  auto add = assign->rhs_->ToBinaryOp();
+  auto one = add ? add->rhs_->ToConstant(): nullptr;
+  return add && add->op_ == '+' && AsObject(add->lhs_) == obj &&
+         one && one->Type()->IsInteger() && one->IVal() == 1;
+}
+
+
+// Collects the arrays and invariants of the element-wise 'expr',
+// its value goes in the packed register of 'depth'
+bool Generator::MatchVectorExpr(Expr* expr, VectorLoop& loop, int depth) {
+  auto type = expr->Type();
+  if (!type->ToArithm() || type->IsFloat() != loop.type_->IsFloat() ||
+      type->Width() != loop.type_->Width()) {
+    return false;
+  }
+  auto array = VectorArray(expr, loop.index_);
+  if (array) {
+    if (!loop.bases_.count(array)) {
+      loop.arrays_.push_back(array);
+      loop.bases_[array] = "";
+    }
+    loop.depth_ = std::max(loop.depth_, depth + 1);
+    return true;
+  }
+
+  auto obj = AsObject(expr);
+  if (expr->ToConstant() || (obj && obj != loop.index_ &&
+                             localVRegs_.count(obj))) {
+    loop.invariants_.push_back(expr);
+    return true;
+  }
+  auto binary = expr->ToBinaryOp();
+  if (!binary || !PackedInst(type, binary->op_))
+    return false;
+  loop.depth_ = std::max(loop.depth_, depth + 1);
+  return MatchVectorExpr(binary->lhs_, loop, depth) &&
+         MatchVectorExpr(binary->rhs_, loop, depth + 1);
+}
+
+
+/*
+ * Emits the packed loop for the counted loops 'for (; i < n; ++i)'
+ * whose body is 'a[i] = expr' of ints, longs, floats or doubles only.
+ * It runs while 'i + lanes <= n', the scalar loop that follows
+ * does the remaining iterations. Unless the stored pointer is restrict,
+ * the arrays are checked not to overlap within a packed register,
+ * or the scalar loop does all the iterations.
+ */
+void Generator::GenVectorLoop(LoopStmt* loopStmt) {
+  auto cond = loopStmt->cond_ ? loopStmt->cond_->ToBinaryOp(): nullptr;
+  if (loopStmt->doWhile_ || !loopStmt->step_ || !cond || cond->op_ != '<')
+    return;
+  auto index = AsObject(cond->lhs_);
+  auto bound = AsObject(cond->rhs_);
+  if (!index || !localVRegs_.count(index) ||
+      !IsVectorIndex(index->Type()) || !IsVectorIndex(cond->rhs_->Type()) ||
+      !(cond->rhs_->ToConstant() ||
+        (bound && bound != index && localVRegs_.count(bound))) ||
+      !IsIncrement(loopStmt->step_, index)) {
+    return;
+  }
+
+  auto body = loopStmt->body_;
+  auto block = body->ToCompoundStmt();
+  if (block && block->stmts_.size() == 1)
+    body = block->stmts_.front();
+  auto assign = body->ToExpr() ? body->ToExpr()->ToBinaryOp(): nullptr;
+  if (!assign || assign->op_ != '=')
+    return;
+  // Narrower lanes would need their own broadcasts and packed moves
+  auto type = assign->Type();
+  if (!type->ToArithm() || (type->Width() != 4 && type->Width() != 8))
+    return;
+  VectorLoop loop {index, type, 0};
+  if (!MatchVectorExpr(assign->lhs_, loop, 0) || loop.depth_ != 1 ||
+      !loop.invariants_.empty() || !MatchVectorExpr(assign->rhs_, loop, 0) ||
+      loop.depth_ + loop.invariants_.size() > 7) {
+    return;
+  }
+
+  auto base = offset_;
+  auto scalar = LabelStmt::New();
+  auto longType = ArithmType::New(T_LONG);
+  for (auto array: loop.arrays_) {
+    offset_ -= 8;
+    loop.bases_[array] = VRegName(NewVReg(offset_, longType));
+    Visit(array);
+    Emit("movq", "%rax", loop.bases_[array]);
+  }
+  auto store = loop.arrays_.front();
+  for (auto array: loop.arrays_) {
+    if (array == store || store->IsRestrictQualified() ||
+        (array->Type()->ToArray() && store->Type()->ToArray())) {
+      continue;
+    }
+    // The elements stored may not be loaded in later lanes
+    Emit("movq", loop.bases_[store], "%rax");
+    Emit("subq", loop.bases_[array], "%rax");
+    Emit("subq", 1, "%rax");
+    Emit("cmpq", 15, "%rax");
+    Emit("jb", scalar);
+  }
+
+  auto width = loop.type_->Width();
+  auto lanes = 16 / width;
+  offset_ -= 8;
+  auto limit = VRegName(NewVReg(offset_, longType));
+  Visit(cond->rhs_);
+  EmitExtend(4, true);
+  Emit("subq", lanes, "%rax");
+  Emit("movq", "%rax", limit);
+  for (size_t i = 0; i < loop.invariants_.size(); ++i) {
+    auto reg = "%xmm" + std::to_string(7 - i);
+    loop.regs_[loop.invariants_[i]] = reg;
+    Visit(loop.invariants_[i]);
+    if (loop.type_->IsFloat()) {
+      Emit(PackedInst(loop.type_, 'c'), "%xmm0", reg);
+      if (width == 4)
+        Emit("shufps", "$0, " + reg, reg);
+      else
+        Emit("unpcklpd", reg, reg);
+    } else if (width == 4) {
+      Emit("movd", "%eax", reg);
+      Emit("pshufd", "$0, " + reg, reg);
+    } else {
+      Emit("movq", "%rax", reg);
+      Emit("punpcklqdq", reg, reg);
+    }
+  }
+
+  auto top = LabelStmt::New();
+  Emit(".p2align", "4,,10");
+  EmitLabel(LabelRepr(top));
+  Visit(index);
+  EmitExtend(4, true);
+  Emit("cmpq", limit, "%rax");
+  Emit("jg", scalar);
+  Emit("movq", "%rax", "%rcx");
+  auto reg = GenVectorExpr(assign->rhs_, loop, 0);
+  Emit("movq", loop.bases_[store], "%r10");
+  auto elem = "(%r10,%rcx," + std::to_string(width) + ")";
+  Emit(PackedInst(loop.type_, '='), reg, elem);
+  Emit("addl", lanes, VRegName(localVRegs_[index]));
+  Emit("jmp", top);
+  EmitLabel(LabelRepr(scalar));
+  offset_ = base;
+}
+
+
+// The packed register with the value of 'expr', %rcx has the index
+std::string Generator::GenVectorExpr(Expr* expr, VectorLoop& loop,
+                                     int depth) {
+  if (loop.regs_.count(expr))
+    return loop.regs_[expr];
+  auto reg = "%xmm" + std::to_string(depth + 1);
+  auto array = VectorArray(expr, loop.index_);
+  if (array) {
+    auto width = std::to_string(loop.type_->Width());
+    Emit("movq", loop.bases_[array], "%r10");
+    Emit(PackedInst(loop.type_, '='), "(%r10,%rcx," + width + ")", reg);
+    return reg;
+  }
+  auto binary = expr->ToBinaryOp();
+  auto lhs = GenVectorExpr(binary->lhs_, loop, depth);
+  if (lhs != reg)
+    Emit(PackedInst(loop.type_, 'c'), lhs, reg);
+  auto rhs = GenVectorExpr(binary->rhs_, loop, depth + 1);
+  Emit(PackedInst(loop.type_, binary->op_), rhs, reg);
+  return reg;
+}
+
+
+void Generator::VisitJumpStmt(JumpStmt* jumpStmt) {
+  Emit("jmp", jumpStmt->label_);
+}
+
+
+void Generator::VisitLabelStmt(LabelStmt* labelStmt) {
+  EmitLabel(LabelRepr(labelStmt));
+}
+
+
+void Generator::VisitReturnStmt(ReturnStmt* returnStmt) {
   auto expr = returnStmt->expr_;
+  if (expr && expr->ToFuncCall() && GenTailCall(expr->ToFuncCall()))
+    return;
   if (expr) { // The return expr could be nil
     Visit(expr);
     if (expr->Type()->ToStruct()) {
@@ -949,7 +2013,10 @@ void Generator::VisitReturnStmt(ReturnStmt* returnStmt) {
       Emit("movq", "%r11", "%rax");
     }
   }
-  Emit("jmp", curFunc_->retLabel_);
+  if (inlineExit_.size())
+    Emit("jmp", inlineExit_);
+  else
+    Emit("jmp", curFunc_->retLabel_);
 }
 
 
@@ -979,6 +2046,13 @@ void Generator::AllocObjects(Scope* scope, const FuncDef::ParamList& params) {
     auto obj = heap.top();
     heap.pop();
 
+    if (promoted_.count(obj)) {
+      offset = Type::MakeAlign(offset - 8, 8);
+      obj->SetOffset(offset);
+      localVRegs_[obj] = NewVReg(offset, obj->Type());
+      continue;
+    }
+
     offset -= obj->Type()->Width();
     auto align = obj->Align();
     if (obj->Type()->ToArray()) {
@@ -1012,7 +2086,8 @@ void Generator::GetParamRegOffsets(int& gpOffset,
   TypeList types;
   for (auto param: funcType->Params())
     types.push_back(param->Type());
-  auto locations = GetParamLocations(types, funcType->Derived());
+  auto retStruct = funcType->Derived()->ToStruct() != nullptr;
+  auto locations = GetParamLocations(types, retStruct);
   gpOffset = 0;
   fpOffset = 48;
   overflow = 16;
@@ -1120,12 +2195,149 @@ void Generator::GenBuiltin(FuncCall* funcCall) {
 }
 
 
+// The largest body, in IR instructions, inlined without always_inline
+static const size_t inlineLimit = 40;
+
+
+bool Generator::ShouldInline(FuncDef* funcDef, FuncCall* funcCall) {
+  auto funcType = funcDef->FuncType();
+  // The objects of the bodies being generated keep their slots
+  if (!funcDef->Body() || funcType->IsNoInline() || funcType->Variadic() ||
+      funcDef == curFunc_ || inlining_.count(funcDef)) {
+    return false;
+  }
+  if (!funcType->IsAlwaysInline() && (!optimize ||
+      (funcDef->Linkage() != L_INTERNAL && !funcType->IsInline()))) {
+    return false;
+  }
+
+  // Params and the return value are scalars, bound like assignments
+  const auto& params = funcType->Params();
+  const auto& args = funcCall->args_;
+  if (funcType->Derived()->ToStruct() || params.size() != args.size())
+    return false;
+  for (size_t i = 0; i < params.size(); ++i) {
+    if (!params[i]->Type()->IsScalar() ||
+        !params[i]->Type()->Compatible(*args[i]->Type())) {
+      return false;
+    }
+  }
+
+  auto irFunc = IRBuilder().Build(funcDef);
+  // Compound literals are initialized only once
+  for (const auto& slot: irFunc->slots_) {
+    if (slot.first->Anonymous())
+      return false;
+  }
+  size_t cost = 0;
+  for (auto block: irFunc->blocks_)
+    cost += block->insts_.size();
+  return funcType->IsAlwaysInline() || cost <= inlineLimit;
+}
+
+
+/*
+ * A call of a function defined in the translation unit is replaced
+ * by its body. The params get slots in the frame of the caller and
+ * the returns jump to the end of the body, with the value in the
+ * accumulator. The labels of the body are renamed, as it may be
+ * inlined more than once.
+ */
+bool Generator::GenInline(FuncCall* funcCall) {
+  auto ident = funcCall->Designator()->ToIdentifier();
+  if (!ident || ident->ToObject() || !funcDefs_.count(ident->Name()))
+    return false;
+  auto funcDef = funcDefs_[ident->Name()];
+  if (!ShouldInline(funcDef, funcCall))
+    return false;
+
+  // All arguments are evaluated before any param is bound,
+  // an argument may inline the same function
+  auto base = offset_;
+  const auto& params = funcDef->FuncType()->Params();
+  std::vector<int> offsets;
+  for (size_t i = 0; i < params.size(); ++i) {
+    Visit(funcCall->args_[i]);
+    offsets.push_back(Push(params[i]->Type()));
+  }
+  if (optimize)
+    PromoteLocals(funcDef);
+  for (size_t i = 0; i < params.size(); ++i) {
+    auto param = params[i];
+    param->SetOffset(offsets[i]);
+    if (promoted_.count(param)) {
+      auto idx = NewVReg(param->Offset(), param->Type());
+      localVRegs_[param] = idx;
+      auto type = param->Type();
+      Emit(GetInst("mov", type->Width(), type->IsFloat()),
+           ObjectAddr(param->Offset()).Repr(), VRegName(idx));
+    }
+  }
+
+  static int cnt = 0;
+  auto exit = LabelRepr(LabelStmt::New());
+  auto inlineExit = inlineExit_;
+  auto labelSuffix = labelSuffix_;
+  inlineExit_ = exit;
+  labelSuffix_ = "_" + std::to_string(++cnt);
+  inlining_.insert(funcDef);
+
+  AllocObjects(funcDef->Body()->Scope(), params);
+  for (auto stmt: funcDef->Body()->stmts_)
+    Visit(stmt);
+
+  inlining_.erase(funcDef);
+  inlineExit_ = inlineExit;
+  labelSuffix_ = labelSuffix;
+  EmitLabel(exit);
+  offset_ = base;
+  return true;
+}
+
+
 void Generator::VisitFuncCall(FuncCall* funcCall) {
   EmitLoc(funcCall);
   auto funcType = funcCall->FuncType();
   if (Parser::IsBuiltin(funcType))
     return GenBuiltin(funcCall);
+  if (GenInline(funcCall))
+    return;
+  GenCall(funcCall, false);
+}
+
+
+/*
+ * A call in tail position jumps to the callee after the frame is torn
+ * down, when it does not return a struct, takes no argument on the stack
+ * and no pointer into the frame may be passed to it.
+ */
+bool Generator::GenTailCall(FuncCall* funcCall) {
+  auto funcType = funcCall->FuncType();
+  if (!tailCalls_ || inlineExit_.size() || Parser::IsBuiltin(funcType) ||
+      funcCall->Type()->ToStruct()) {
+    return false;
+  }
+  auto ident = funcCall->Designator()->ToIdentifier();
+  if (ident && !ident->ToObject() && funcDefs_.count(ident->Name()) &&
+      ShouldInline(funcDefs_[ident->Name()], funcCall)) {
+    return false;
+  }
+
+  TypeList types;
+  for (auto arg: funcCall->args_)
+    types.push_back(arg->Type());
+  const auto& locations = GetParamLocations(types, false);
+  if (locations.locs_.size() != locations.regCnt_ + locations.xregCnt_)
+    return false;
+
+  EmitLoc(funcCall);
+  GenCall(funcCall, true);
+  return true;
+}
+
 
+void Generator::GenCall(FuncCall* funcCall, bool tail) {
+  auto funcType = funcCall->FuncType();
   auto base = offset_;
   // Alloc memory for return value if it is struct/union
   int retStructOffset;
@@ -1151,6 +2363,8 @@ void Generator::VisitFuncCall(FuncCall* funcCall) {
   auto byMemCnt = locs.size() - locations.regCnt_ - locations.xregCnt_;
 
   offset_ = Type::MakeAlign(offset_ - byMemCnt * 8, 16) + byMemCnt * 8;
+  makesCalls_ = true;
+  stackArgs_ = stackArgs_ || byMemCnt > 0;
   for (int i = locs.size() - 1; i >=0; --i) {
     if (locs[i][1] == 'm') {
       Visit(funcCall->args_[i]);
@@ -1158,33 +2372,68 @@ void Generator::VisitFuncCall(FuncCall* funcCall) {
     }
   }
 
+  // The other arguments are staged in temporaries
+  std::vector<int> direct;
   for (int i = locs.size() - 1; i >= 0; --i) {
     if (locs[i][1] == 'm')
       continue;
+    if (IsSimpleExpr(funcCall->args_[i])) {
+      direct.push_back(i);
+      continue;
+    }
     Visit(funcCall->args_[i]);
-    Push(funcCall->args_[i]->Type());
+    PushTemp(locs[i][1] == 'x' ? "%xmm0": "%rax");
+  }
+
+  // %xmm0 is also the accumulator, so its argument comes last
+  std::stable_partition(direct.begin(), direct.end(), [&locs](int i) {
+    return locs[i] != std::string("%xmm0");
+  });
+  for (auto i: direct) {
+    auto arg = funcCall->args_[i];
+    auto cons = arg->ToConstant();
+    if (cons && cons->Type()->IsInteger() &&
+        cons->IVal() == static_cast<int>(cons->IVal())) {
+      Emit("movq", static_cast<int>(cons->IVal()), locs[i]);
+      continue;
+    }
+    Visit(arg);
+    if (locs[i][1] != 'x')
+      Emit("movq", "%rax", locs[i]);
+    else if (locs[i] != std::string("%xmm0"))
+      Emit("movsd", "%xmm0", locs[i]);
   }
 
-  for (const auto& loc: locs) {
-    if (loc[1] != 'm')
-      Pop(loc);
+  for (int i = 0; i < static_cast<int>(locs.size()); ++i) {
+    if (locs[i][1] != 'm' &&
+        std::find(direct.begin(), direct.end(), i) == direct.end()) {
+      PopTemp(locs[i]);
+    }
   }
 
-  // If variadic, set %al to floating param number
-  if (funcType->Variadic()) {
-    Emit("movq", locations.xregCnt_, "%rax");
-  }
   if (retType) {
     Emit("leaq", ObjectAddr(retStructOffset), "%rdi");
   }
 
-  Emit("leaq", ObjectAddr(offset_), "%rsp");
+  if (!tail)
+    Emit("leaq", ObjectAddr(offset_), "%rsp");
   auto addr = LValGenerator().GenExpr(funcCall->Designator());
-  if (addr.base_.size() == 0 && addr.offset_ == 0) {
-    Emit("call", addr.label_);
-  } else {
+  auto directCall = addr.base_.size() == 0 && addr.offset_ == 0;
+  if (!directCall)
     Emit("leaq", addr, "%r10");
-    Emit("call", "*%r10");
+  // If variadic, set %al to floating param number
+  if (funcType->Variadic()) {
+    Emit("movq", locations.xregCnt_, "%rax");
+  }
+  auto call = tail ? "jmp": "call";
+  if (tail) {
+    Output(restoresMark);
+    Emit("leaveq");
+  }
+  if (directCall) {
+    Emit(call, addr.label_);
+  } else {
+    Emit(call, "*%r10");
   }
 
   // Reset stack frame
@@ -1192,6 +2441,47 @@ void Generator::VisitFuncCall(FuncCall* funcCall) {
 }
 
 
+/*
+ * Whether 'expr' is evaluated without calls and without clobbering any
+ * register but the accumulators and %r10, %r11, %xmm9.
+ * Such an argument is evaluated right into its register.
+ */
+bool Generator::IsSimpleExpr(Expr* expr) {
+  if (expr->ToConstant() || expr->ToIdentifier())
+    return true;
+
+  if (auto unary = expr->ToUnaryOp()) {
+    switch (unary->op_) {
+    case Token::ADDR: case Token::DEREF: case Token::CAST:
+    case Token::PLUS: case Token::MINUS: case '~': case '!':
+      return IsSimpleExpr(unary->operand_);
+    default:
+      return false;
+    }
+  }
+
+  if (auto binary = expr->ToBinaryOp()) {
+    auto op = binary->op_;
+    // Division, shifts by a variable and assignments use %rcx, %rdx,
+    // %rsi or %rdi
+    if (op == '=' || op == '/' || op == '%' ||
+        ((op == Token::LEFT || op == Token::RIGHT) &&
+         !binary->rhs_->ToConstant()) ||
+        (op == '-' && binary->lhs_->Type()->ToPointer() &&
+         binary->rhs_->Type()->ToPointer())) {
+      return false;
+    }
+    if (op == '.')
+      return IsSimpleExpr(binary->lhs_);
+    return IsSimpleExpr(binary->lhs_) && IsSimpleExpr(binary->rhs_);
+  }
+
+  auto cond = expr->ToConditionalOp();
+  return cond && IsSimpleExpr(cond->cond_) &&
+         IsSimpleExpr(cond->exprTrue_) && IsSimpleExpr(cond->exprFalse_);
+}
+
+
 ParamLocations Generator::GetParamLocations(const TypeList& types,
                                             bool retStruct) {
   ParamLocations locations;
@@ -1216,6 +2506,13 @@ ParamLocations Generator::GetParamLocations(const TypeList& types,
 
 
 void Generator::VisitFuncDef(FuncDef* funcDef) {
+  tailCalls_ = false;
+  makesCalls_ = stackArgs_ = false;
+  if (optimize) {
+    ConstantFolder().Fold(funcDef);
+    tailCalls_ = PromoteLocals(funcDef) &&
+                 !funcDef->FuncType()->Variadic();
+  }
   curFunc_ = funcDef;
 
   auto name = funcDef->Name();
@@ -1287,15 +2584,513 @@ void Generator::VisitFuncDef(FuncDef* funcDef) {
     }
   }
 
+  if (optimize) {
+    // Callee-saved registers given to virtual registers are saved here,
+    // AllocRegs() gives back the slots not needed
+    offset_ -= 8 * (calleeSavedRegs.size() + omit_frame_pointer);
+    calleeSaveOffset_ = offset_;
+    prologueEnd_ = insts_.size();
+
+    // Promoted params are moved from their home slots
+    for (size_t i = 0; i < params.size(); ++i) {
+      auto param = params[i];
+      if (!promoted_.count(param) || locs[i][1] == 'm' ||
+          funcDef->FuncType()->Variadic()) {
+        continue;
+      }
+      auto idx = NewVReg(param->Offset(), param->Type());
+      localVRegs_[param] = idx;
+      auto type = param->Type();
+      Emit(GetInst("mov", type->Width(), type->IsFloat()),
+           ObjectAddr(param->Offset()).Repr(), VRegName(idx));
+    }
+  }
+
   AllocObjects(funcDef->Body()->Scope(), params);
 
   for (auto stmt: funcDef->body_->stmts_) {
     Visit(stmt);
   }
 
-  EmitLabel(funcDef->retLabel_->Repr());
+  EmitLabel(LabelRepr(funcDef->retLabel_));
+  if (optimize) {
+    AllocRegs();
+  }
   Emit("leaveq");
   Emit("retq");
+  if (optimize) {
+    Peephole();
+    LayoutFrame();
+    FlushFunc();
+  }
+  curFunc_ = nullptr;
+}
+
+
+/*
+ * Linear scan allocation of the virtual registers of the current function.
+ * An interval spans from the first to the last use, extended to cover
+ * the loops it is live in. When there is no free register, the interval
+ * that ends last keeps its home slot.
+ * Restores of the used callee-saved registers are emitted here,
+ * the saves are inserted at the end of the prologue.
+ */
+void Generator::AllocRegs() {
+  std::vector<int> calls;
+  std::map<std::string, int> labels;
+  std::vector<std::pair<int, int>> loops;
+  for (size_t i = 0; i < insts_.size(); ++i) {
+    const auto& inst = insts_[i];
+    if (inst.compare(0, 5, "\tcall") == 0) {
+      calls.push_back(i);
+    } else if (inst[0] != '\t' && inst.back() == ':') {
+      labels[inst.substr(0, inst.size() - 1)] = i;
+    } else if (inst.compare(0, 2, "\tj") == 0) {
+      auto label = labels.find(inst.substr(inst.rfind('\t') + 1));
+      if (label != labels.end())
+        loops.push_back({label->second, i});
+    }
+    MapVRegs(inst, [this, i](int idx) {
+      auto& vreg = vregs_[idx];
+      if (vreg.begin_ == -1)
+        vreg.begin_ = i;
+      vreg.end_ = i;
+      return "";
+    });
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto& vreg: vregs_) {
+      for (const auto& loop: loops) {
+        // Either not overlapping, inside or already covering the loop
+        if (vreg.begin_ == -1 || vreg.end_ < loop.first ||
+            vreg.begin_ > loop.second ||
+            (vreg.begin_ >= loop.first && vreg.end_ <= loop.second) ||
+            (vreg.begin_ <= loop.first && vreg.end_ >= loop.second)) {
+          continue;
+        }
+        vreg.begin_ = std::min(vreg.begin_, loop.first);
+        vreg.end_ = std::max(vreg.end_, loop.second);
+        changed = true;
+      }
+    }
+  }
+
+  auto acrossCall = [&calls](const VReg& vreg) {
+    auto call = std::upper_bound(calls.begin(), calls.end(), vreg.begin_);
+    return call != calls.end() && *call < vreg.end_;
+  };
+
+  std::vector<VReg*> intervals;
+  for (auto& vreg: vregs_) {
+    if (vreg.begin_ != -1)
+      intervals.push_back(&vreg);
+  }
+  std::stable_sort(intervals.begin(), intervals.end(),
+                   [](const VReg* lhs, const VReg* rhs) {
+    return lhs->begin_ < rhs->begin_;
+  });
+
+  auto allocatable = calleeSavedRegs;
+  if (OmitFrame())
+    allocatable.push_back("%rbp");
+  std::vector<const char*> freeRegs(allocatable.rbegin(),
+                                    allocatable.rend());
+  std::vector<const char*> freeXregs(tempXregs.rbegin(), tempXregs.rend());
+  std::set<std::string> usedRegs;
+  std::vector<VReg*> active;
+  for (auto vreg: intervals) {
+    // Expire intervals that end before this one begins
+    for (auto iter = active.begin(); iter != active.end();) {
+      if ((*iter)->end_ >= vreg->begin_) {
+        ++iter;
+        continue;
+      }
+      auto& pool = (*iter)->flt_ ? freeXregs: freeRegs;
+      pool.push_back((*iter)->reg_.c_str());
+      iter = active.erase(iter);
+    }
+
+    // Xmm registers are all caller-saved
+    if (vreg->flt_ && acrossCall(*vreg))
+      continue;
+    auto& pool = vreg->flt_ ? freeXregs: freeRegs;
+    if (pool.size()) {
+      vreg->reg_ = pool.back();
+      pool.pop_back();
+    } else {
+      VReg* spill = nullptr;
+      for (auto other: active) {
+        if (other->flt_ == vreg->flt_ && other->end_ > vreg->end_ &&
+            (spill == nullptr || other->end_ > spill->end_)) {
+          spill = other;
+        }
+      }
+      if (spill == nullptr)
+        continue;
+      vreg->reg_ = spill->reg_;
+      spill->reg_.clear();
+      active.erase(std::find(active.begin(), active.end(), spill));
+    }
+    active.push_back(vreg);
+    if (!vreg->flt_)
+      usedRegs.insert(vreg->reg_);
+  }
+
+  InstList insts;
+  for (const auto& inst: insts_) {
+    auto replaced = MapVRegs(inst, [this](int idx) {
+      const auto& vreg = vregs_[idx];
+      if (vreg.reg_.empty())
+        return ObjectAddr(vreg.offset_).Repr();
+      return vreg.flt_ ? vreg.reg_: RegOfWidth(vreg.reg_, vreg.width_);
+    });
+    // Drop moves made redundant, like the copy of a param to its slot
+    if (replaced != inst && replaced.compare(0, 4, "\tmov") == 0) {
+      auto src = replaced.find('\t', 1) + 1;
+      auto sep = replaced.find(", ", src);
+      if (replaced.substr(src, sep - src) == replaced.substr(sep + 2))
+        continue;
+    }
+    insts.push_back(replaced);
+  }
+  insts_.swap(insts);
+
+  // Slots of unused callee-saved registers are given back by moving
+  // the frame below them up, keeping it 16 bytes aligned
+  int reserved = calleeSavedRegs.size() + omit_frame_pointer;
+  int unused = 8 * (reserved - usedRegs.size());
+  int delta = unused / 16 * 16;
+  if (delta) {
+    for (auto& inst: insts_)
+      inst = ShiftFrame(inst, calleeSaveOffset_, delta);
+    std::map<int, int> slots;
+    for (const auto& slot: volatileSlots_) {
+      auto offset = slot.first + (slot.first < calleeSaveOffset_ ? delta: 0);
+      slots[offset] = slot.second;
+    }
+    volatileSlots_.swap(slots);
+  }
+
+  InstList saves, restores;
+  int offset = calleeSaveOffset_ + delta;
+  for (auto reg: allocatable) {
+    if (usedRegs.count(reg)) {
+      saves.push_back("\tmovq\t" + std::string(reg) + ", " +
+                      ObjectAddr(offset).Repr());
+      restores.push_back("\tmovq\t" + ObjectAddr(offset).Repr() + ", " +
+                         std::string(reg));
+      offset += 8;
+    }
+  }
+
+  // Tail calls restore the registers before leaving the frame too
+  insts.clear();
+  for (const auto& inst: insts_) {
+    if (inst == restoresMark)
+      insts.insert(insts.end(), restores.begin(), restores.end());
+    else
+      insts.push_back(inst);
+  }
+  insts.insert(insts.end(), restores.begin(), restores.end());
+  insts_.swap(insts);
+  insts_.insert(insts_.begin() + prologueEnd_, saves.begin(), saves.end());
+}
+
+
+// Whether the current function addresses its frame by %rsp
+// and gives %rbp to the allocator
+bool Generator::OmitFrame() {
+  return optimize && omit_frame_pointer && !stackArgs_ &&
+         !curFunc_->FuncType()->Variadic();
+}
+
+
+/*
+ * Leaf functions whose frame fits in the red zone below %rsp, and the
+ * functions of OmitFrame(), do not set up %rbp and address their frame
+ * by %rsp. Other leaf functions move %rsp below the part of their frame
+ * out of the red zone, that signal handlers may overwrite.
+ */
+void Generator::LayoutFrame() {
+  int low = 0;
+  for (const auto& inst: insts_) {
+    MapSlots(inst, [&low](int offset) {
+      low = std::min(low, offset);
+      return std::string();
+    });
+  }
+
+  static const std::string push = "\tpushq\t%rbp";
+  static const std::string setup = "\tmovq\t%rsp, %rbp";
+  auto variadic = curFunc_->FuncType()->Variadic();
+  bool redZone = !makesCalls_ && !variadic && 8 - low <= 128;
+  if (!redZone && !OmitFrame()) {
+    if (!makesCalls_ && -low > 128) {
+      auto prologue = std::find(insts_.begin(), insts_.end(), setup);
+      auto size = Type::MakeAlign(-low - 128, 16);
+      insts_.insert(prologue + 1,
+                    "\tsubq\t$" + std::to_string(size) + ", %rsp");
+    }
+    return;
+  }
+
+  // %rsp stays 16 bytes aligned at the calls
+  int frame = redZone ? 0: Type::MakeAlign(-low, 16) + 8;
+  auto size = "$" + std::to_string(frame) + ", %rsp";
+  InstList insts;
+  for (const auto& inst: insts_) {
+    if (inst == push || inst == "\tleaveq") {
+      if (frame)
+        insts.push_back((inst == push ? "\tsubq\t": "\taddq\t") + size);
+    } else if (inst == setup || (inst.compare(0, 6, "\tleaq\t") == 0 &&
+               inst.compare(inst.size() - 6, 6, ", %rsp") == 0)) {
+      // The frame pointer, and %rsp before each call, are not set
+    } else {
+      insts.push_back(MapSlots(inst, [frame](int offset) {
+        return std::to_string(offset - 8 + frame) + "(%rsp)";
+      }));
+    }
+  }
+  insts_.swap(insts);
+}
+
+
+void Generator::FlushFunc() {
+  for (const auto& inst: insts_)
+    fprintf(outFile_, "%s\n", inst.c_str());
+  insts_.clear();
+  vregs_.clear();
+  promoted_.clear();
+  localVRegs_.clear();
+  volatileSlots_.clear();
+  volatileLabels_.clear();
+}
+
+
+bool Generator::IsPlainSlot(const std::string& operand) {
+  auto base = operand.rfind('(');
+  if (base == std::string::npos)
+    return false;
+  if (operand.compare(base, std::string::npos, "(%rip)") == 0) {
+    auto label = operand.substr(0, std::min(base, operand.find('+')));
+    return !volatileLabels_.count(label);
+  }
+  if (operand.compare(base, std::string::npos, "(%rbp)") != 0)
+    return false;
+  int offset = base ? std::stoi(operand.substr(0, base)): 0;
+  for (const auto& slot: volatileSlots_) {
+    if (offset + 8 > slot.first && offset < slot.first + slot.second)
+      return false;
+  }
+  return true;
+}
+
+
+// Splits "\tmovq\t%rax, -8(%rbp)" into {"movq", "%rax", "-8(%rbp)"},
+// a label gives an empty list
+static std::vector<std::string> SplitInst(const std::string& inst) {
+  std::vector<std::string> ret;
+  if (inst.empty() || inst[0] != '\t')
+    return ret;
+  auto end = inst.find_first_of(" \t", 1);
+  ret.push_back(inst.substr(1, end - 1));
+  auto begin = inst.find_first_not_of(" \t", end);
+  while (begin != std::string::npos) {
+    auto sep = inst.find(", ", begin);
+    ret.push_back(inst.substr(begin, sep - begin));
+    begin = sep == std::string::npos ? sep: sep + 2;
+  }
+  return ret;
+}
+
+
+static bool IsLabel(const std::string& inst, const std::string& label="") {
+  if (inst.empty() || inst[0] == '\t' || inst.back() != ':')
+    return false;
+  return label.empty() || inst.compare(0, inst.size() - 1, label) == 0;
+}
+
+
+static bool IsReg(const std::string& operand) {
+  return operand[0] == '%' && operand.find('(') == std::string::npos;
+}
+
+
+// The names of the scratch registers, the 64 and 32 bits names first
+static const std::vector<std::vector<std::string>> scratchRegs {
+  {"%rax", "%eax", "%ax", "%al", "%ah"},
+  {"%rcx", "%ecx", "%cx", "%cl", "%ch"},
+  {"%rdx", "%edx", "%dx", "%dl", "%dh"},
+  {"%r10", "%r10d"},
+  {"%r11", "%r11d"},
+};
+
+
+static bool Mentions(const std::string& inst,
+                     const std::vector<std::string>& names) {
+  for (const auto& name: names) {
+    if (inst.find(name) != std::string::npos)
+      return true;
+  }
+  return false;
+}
+
+
+// A copy to a scratch register that is written again before any read
+static bool DeadCopy(InstList& insts, size_t i) {
+  auto copy = SplitInst(insts[i]);
+  if (copy.size() != 3 || copy[0].compare(0, 3, "mov") ||
+      (!IsReg(copy[1]) && copy[1][0] != '$')) {
+    return false;
+  }
+  auto names = std::find_if(scratchRegs.begin(), scratchRegs.end(),
+                            [&copy](const std::vector<std::string>& names) {
+    return copy[2] == names[0] || copy[2] == names[1];
+  });
+  if (names == scratchRegs.end())
+    return false;
+
+  for (auto j = i + 1; j < insts.size(); ++j) {
+    auto inst = SplitInst(insts[j]);
+    if (inst.empty())
+      return false;
+    // Jumps, calls and instructions with implicit operands
+    if (inst.size() < 3) {
+      if (Mentions(insts[j], *names) || (inst[0].compare(0, 3, "set") &&
+          inst[0].compare(0, 3, "neg") && inst[0].compare(0, 3, "not"))) {
+        return false;
+      }
+      continue;
+    }
+    if (!Mentions(insts[j], *names))
+      continue;
+    bool write = inst[0].compare(0, 3, "mov") == 0 ||
+                 inst[0].compare(0, 3, "lea") == 0;
+    if (inst.size() == 3 && write && !Mentions(inst[1], *names) &&
+        (inst[2] == (*names)[0] || inst[2] == (*names)[1])) {
+      insts.erase(insts.begin() + i);
+      return true;
+    }
+    return false;
+  }
+  return false;
+}
+
+
+// A store to a slot followed by a load of it
+static bool StoreReload(InstList& insts, size_t i) {
+  if (i + 1 >= insts.size())
+    return false;
+  auto store = SplitInst(insts[i]);
+  auto load = SplitInst(insts[i + 1]);
+  if (store.size() != 3 || load.size() != 3 || store[0] != load[0] ||
+      !IsReg(store[1]) || store[2] != load[1] || !IsReg(load[2]) ||
+      !Generator::IsPlainSlot(store[2])) {
+    return false;
+  }
+  // Loading with 'movl' clears the upper half
+  if (store[0] == "movl" || (store[0] == "movq" && store[1] != load[2])) {
+    insts[i + 1] = "\t" + store[0] + "\t" + store[1] + ", " + load[2];
+  } else if (store[1] == load[2] &&
+             (store[0] == "movq" || store[0] == "movsd" ||
+              store[0] == "movss")) {
+    insts.erase(insts.begin() + i + 1);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+
+// A register copied back right after the copy, as by a spill and restore
+static bool PushPop(InstList& insts, size_t i) {
+  if (i + 1 >= insts.size())
+    return false;
+  auto push = SplitInst(insts[i]);
+  auto pop = SplitInst(insts[i + 1]);
+  if (push.size() != 3 || pop.size() != 3 || push[0] != pop[0] ||
+      (push[0] != "movq" && push[0] != "movsd" && push[0] != "movss") ||
+      !IsReg(push[1]) || !IsReg(push[2]) ||
+      push[1] != pop[2] || push[2] != pop[1]) {
+    return false;
+  }
+  insts.erase(insts.begin() + i + 1);
+  return true;
+}
+
+
+// A jump to one of the labels that follow it
+static bool JumpNext(InstList& insts, size_t i) {
+  auto jump = SplitInst(insts[i]);
+  if (jump.size() != 2 || jump[0][0] != 'j')
+    return false;
+  for (auto j = i + 1; j < insts.size() && IsLabel(insts[j]); ++j) {
+    if (IsLabel(insts[j], jump[1])) {
+      insts.erase(insts.begin() + i);
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// A conditional jump over an unconditional one is negated
+static bool BranchOverJump(InstList& insts, size_t i) {
+  if (i + 2 >= insts.size())
+    return false;
+  auto branch = SplitInst(insts[i]);
+  auto jump = SplitInst(insts[i + 1]);
+  if (branch.size() != 2 || branch[0][0] != 'j' || branch[0] == "jmp" ||
+      jump.size() != 2 || jump[0] != "jmp" || jump[1][0] == '*' ||
+      !IsLabel(insts[i + 2], branch[1])) {
+    return false;
+  }
+  auto cond = NegateCond(branch[0].substr(1));
+  if (cond.empty())
+    return false;
+  insts[i] = "\tj" + cond + "\t" + jump[1];
+  insts.erase(insts.begin() + i + 1);
+  return true;
+}
+
+
+PeepholeRuleList Generator::peepholeRules_ {
+  {"store-reload", StoreReload, 0},
+  {"push-pop", PushPop, 0},
+  {"dead-copy", DeadCopy, 0},
+  {"jump-next", JumpNext, 0},
+  {"branch-over-jump", BranchOverJump, 0},
+};
+
+
+/*
+ * Rewrites the instructions of the current function with the
+ * peephole rules, after register allocation. When a rule fires,
+ * the rules are tried again a few instructions back, as the rewrite
+ * may enable them there.
+ */
+void Generator::Peephole() {
+  for (size_t i = 0; i < insts_.size();) {
+    auto rule = std::find_if(peepholeRules_.begin(), peepholeRules_.end(),
+                             [i](PeepholeRule& rule) {
+      return rule.apply_(insts_, i);
+    });
+    if (rule != peepholeRules_.end()) {
+      ++rule->count_;
+      i = i > 2 ? i - 2: 0;
+    } else {
+      ++i;
+    }
+  }
+}
+
+
+void Generator::DumpPeepholeStats(FILE* fp) {
+  for (const auto& rule: peepholeRules_)
+    fprintf(fp, "%-20s%d\n", rule.name_, rule.count_);
 }
 
 
@@ -1314,23 +3109,51 @@ void Generator::GenSaveArea() {
     offset += 16;
   }
   assert(offset == 0);
-  EmitLabel(label->Repr());
+  EmitLabel(LabelRepr(label));
 
   offset_ = begin;
 }
 
 
 void Generator::VisitTranslationUnit(TranslationUnit* unit) {
+  for (auto extDecl: unit->ExtDecls()) {
+    auto funcDef = extDecl->ToFuncDef();
+    if (funcDef)
+      funcDefs_[funcDef->Name()] = funcDef;
+  }
+
   for (auto extDecl: unit->ExtDecls()) {
     Visit(extDecl);
 
-    // Float and string literal
-    if (rodatas_.size())
-      Emit(".section", ".rodata");
+    // Float and string literal, those in the mergeable sections
+    // are shared with the other objects by the linker
+    std::string section;
     for (auto rodata: rodatas_) {
-      if (rodata.align_ == 1) { // Literal
+      // The literal holds its null terminator, '.string' adds it
+      auto& sval = rodata.sval_;
+      auto end = sval.size() - std::min<size_t>(sval.size(), 4);
+      if (sval.compare(end, 4, "\\x00") == 0)
+        sval.resize(end);
+      // Strings of the merged section end at their first null
+      std::string sec = ".rodata";
+      if (rodata.align_ == 1 && sval.find("\\x00") == std::string::npos) {
+        sec = ".rodata.str1.1,\"aMS\",@progbits,1";
+      } else if (rodata.table_.empty() && rodata.align_ != 1) {
+        auto size = std::to_string(rodata.align_);
+        sec = ".rodata.cst" + size + ",\"aM\",@progbits," + size;
+      }
+      if (sec != section)
+        Emit(".section", sec);
+      section = sec;
+
+      if (rodata.table_.size()) {
+        Emit(".align", "4");
         EmitLabel(rodata.label_);
-        Emit(".string", "\"" + rodata.sval_ + "\"");
+        for (auto label: rodata.table_)
+          Emit(".long", label + "-" + rodata.label_);
+      } else if (rodata.align_ == 1) { // Literal
+        EmitLabel(rodata.label_);
+        Emit(".string", "\"" + sval + "\"");
       } else if (rodata.align_ == 4) {
         Emit(".align", "4");
         EmitLabel(rodata.label_);
@@ -1382,9 +3205,16 @@ void Generator::EmitLoc(Expr* expr) {
 }
 
 
+// Narrow signed integers are loaded sign extended, as they will be promoted
 void Generator::EmitLoad(const std::string& addr, Type* type) {
   assert(type->IsScalar());
-  EmitLoad(addr, type->Width(), type->IsFloat());
+  auto width = type->Width();
+  if (width < 4 && type->IsInteger() && !type->IsUnsigned()) {
+    Emit(width == 1 ? "movsbq": "movswq", addr, "%rax");
+    SetRaxExt(0, width);
+    return;
+  }
+  EmitLoad(addr, width, type->IsFloat());
 }
 
 
@@ -1392,6 +3222,34 @@ void Generator::EmitLoad(const std::string& addr, int width, bool flt) {
   auto load = GetLoad(width, flt);
   auto des = GetDes(width == 4 ? 4: 8, flt);
   Emit(load, addr, des);
+  if (!flt && width < 8)
+    SetRaxExt(width, 0);
+}
+
+
+// Extends the low 'width' bytes of %rax to 64 bits, unless they already are
+void Generator::EmitExtend(int width, bool sign) {
+  // An extension from fewer bytes is one from more bytes too,
+  // and a zero extension from fewer bytes is also a sign extension
+  auto zeroExt = raxZeroExt_ && raxZeroExt_ <= width;
+  auto signExt = (raxSignExt_ && raxSignExt_ <= width) ||
+                 (raxZeroExt_ && raxZeroExt_ < width);
+  if (width >= 8 || (sign ? signExt: zeroExt))
+    return;
+
+  switch (width) {
+  case 1: Emit(sign ? "movsbq": "movzbq", "%al", "%rax"); break;
+  case 2: Emit(sign ? "movswq": "movzwq", "%ax", "%rax"); break;
+  case 4:
+    // Writing %eax clears the upper half
+    if (sign)
+      Emit("cltq");
+    else
+      Emit("movl", "%eax", "%eax");
+    break;
+  default: assert(false);
+  }
+  SetRaxExt(sign ? 0: width, sign ? width: 0);
 }
 
 
@@ -1416,12 +3274,37 @@ void Generator::EmitStore(const std::string& addr, int width, bool flt) {
 }
 
 
+void Generator::Output(const std::string& line) {
+  SetRaxExt(0, 0);
+  if (optimize && curFunc_)
+    insts_.push_back(line);
+  else
+    fprintf(outFile_, "%s\n", line.c_str());
+}
+
+
 void Generator::EmitLabel(const std::string& label) {
-  fprintf(outFile_, "%s:\n", label.c_str());
+  Output(label + ":");
 }
 
 
 void Generator::EmitZero(ObjectAddr addr, int width) {
+  if (width > blockSSELimit) {
+    Emit("leaq", addr, "%rdi");
+    Emit("xorl", "%eax", "%eax");
+    Emit("movl", width / 8, "%ecx");
+    Emit("rep stosq");
+    return EmitStringTail(width % 8, true);
+  } else if (width >= 16) {
+    Emit("pxor", "%xmm9", "%xmm9");
+    for (int offset = 0; offset < width; offset += 16) {
+      offset = std::min(offset, width - 16);
+      Emit("movdqu", "%xmm9",
+           ObjectAddr(addr.label_, addr.base_, addr.offset_ + offset));
+    }
+    return;
+  }
+
   int units[] = {8, 4, 2, 1};
   Emit("xorq", "%rax", "%rax");
   for (auto unit: units) {
@@ -1441,11 +3324,11 @@ void LValGenerator::VisitBinaryOp(BinaryOp* binary) {
   addr_ = LValGenerator().GenExpr(binary->lhs_);
   const auto& name = binary->rhs_->Tok()->str_;
   auto structType = binary->lhs_->Type()->ToStruct();
-  auto member = structType->GetMember(name);
+  auto field = structType->GetField(name);
 
-  addr_.offset_ += member->Offset();
-  addr_.bitFieldBegin_ = member->bitFieldBegin_;
-  addr_.bitFieldWidth_ = member->bitFieldWidth_;
+  addr_.offset_ += field->offset_;
+  addr_.bitFieldBegin_ = field->bitFieldBegin_;
+  addr_.bitFieldWidth_ = field->bitFieldWidth_;
 }
 
 
@@ -1460,6 +3343,10 @@ void LValGenerator::VisitUnaryOp(UnaryOp* unary) {
 
 void LValGenerator::VisitObject(Object* obj) {
   EmitLoc(obj);
+  if (localVRegs_.count(obj)) {
+    addr_ = {VRegName(localVRegs_[obj]), "", 0};
+    return;
+  }
   if (!obj->IsStatic() && obj->Anonymous()) {
     assert(obj->Decl());
     Generator().Visit(obj->Decl());
@@ -1471,6 +3358,12 @@ void LValGenerator::VisitObject(Object* obj) {
   } else {
     addr_ = {"", "%rbp", obj->Offset()};
   }
+  if (optimize && obj->IsVolatileQualified()) {
+    if (obj->IsStatic())
+      volatileLabels_.insert(obj->Repr());
+    else
+      volatileSlots_[obj->Offset()] = obj->Type()->Width();
+  }
 }
 
 
@@ -1559,3 +3452,52 @@ StaticInitializer Generator::GetStaticInit(InitList::iterator& iter,
     return StaticInitializer(); // Make compiler happy
   }
 }
+
+
+void OperandGenerator::VisitBinaryOp(BinaryOp* binary) {
+  auto lhs = Need(binary->lhs_);
+  auto rhs = Need(binary->rhs_);
+  need_ = lhs == rhs ? lhs + 1: std::max(lhs, rhs);
+}
+
+
+void OperandGenerator::VisitUnaryOp(UnaryOp* unary) {
+  need_ = Need(unary->operand_);
+}
+
+
+void OperandGenerator::VisitConditionalOp(ConditionalOp* condOp) {
+  need_ = std::max({Need(condOp->cond_), Need(condOp->exprTrue_),
+                    Need(condOp->exprFalse_)});
+}
+
+
+void OperandGenerator::VisitObject(Object* obj) {
+  auto type = obj->Type();
+  if (width_ == 0 || !type->IsScalar() || type->Width() != width_ ||
+      obj->Anonymous() || obj->IsVolatileQualified()) {
+    return;
+  }
+  operand_ = LValGenerator().GenExpr(obj).Repr();
+}
+
+
+void OperandGenerator::VisitEnumerator(Enumerator* enumer) {
+  if (width_ != 0)
+    operand_ = "$" + std::to_string(enumer->Val());
+}
+
+
+void OperandGenerator::VisitConstant(Constant* cons) {
+  auto type = cons->Type();
+  if (width_ == 0 || !type->IsScalar()) {
+    return;
+  } else if (type->IsFloat()) {
+    if (type->Width() == width_)
+      operand_ = ConsLabel(cons);
+  } else if (width_ == 4) {
+    operand_ = "$" + std::to_string(static_cast<int>(cons->IVal()));
+  } else if (cons->IVal() == static_cast<int>(cons->IVal())) {
+    operand_ = "$" + std::to_string(cons->IVal());
+  }
+}
@@ -4,6 +4,10 @@
 #include "ast.h"
 #include "visitor.h"
 
+#include <functional>
+#include <map>
+#include <set>
+
 
 class Parser;
 struct Addr;
@@ -15,6 +19,7 @@ using TypeList = std::vector<Type*>;
 using LocationList = std::vector<std::string>;
 using RODataList = std::vector<ROData>;
 using StaticInitList = std::vector<StaticInitializer>;
+using InstList = std::vector<std::string>;
 
 
 enum class ParamClass {
@@ -34,6 +39,21 @@ struct ParamLocations {
   size_t xregCnt_;
 };
 
+// The loop 'for (; i < n; ++i) a[i] = expr' to vectorize, where expr
+// combines the elements b[i] of arrays and loop invariants
+struct VectorLoop {
+  Object* index_;
+  Type* type_;  // Of the elements
+  int depth_;   // Number of packed registers the expr needs
+  // The arrays, the first is stored to, and the registers of their address
+  std::vector<Object*> arrays_;
+  std::map<Object*, std::string> bases_;
+  // The invariants, and the packed registers they are broadcast in
+  std::vector<Expr*> invariants_;
+  std::map<Expr*, std::string> regs_;
+};
+
+
 struct ROData {
   ROData(long ival, int align): ival_(ival), align_(align) {
     label_ = ".LC" + std::to_string(GenTag());
@@ -43,11 +63,18 @@ struct ROData {
     label_ = ".LC" + std::to_string(GenTag());
   }
 
+  // A jump table, each entry is the offset of a label to the table
+  explicit ROData(const std::vector<std::string>& table)
+      : align_(4), table_(table) {
+    label_ = ".LC" + std::to_string(GenTag());
+  }
+
   ~ROData() {}
 
   std::string sval_;
   long ival_;
   int align_;
+  std::vector<std::string> table_;
   std::string label_;
 
 private:
@@ -75,6 +102,35 @@ struct ObjectAddr {
 };
 
 
+/*
+ * With -O1, a temporary pushed by the generator, or a local whose address
+ * is never taken, is a virtual register. It keeps its home slot in the
+ * frame, which is used when the register allocator could not give it a
+ * physical register.
+ */
+struct VReg {
+  int offset_;  // Home slot
+  bool flt_;
+  int width_;
+  int begin_;   // Index of the first instruction using it
+  int end_;     // Index of the last one
+  std::string reg_;
+};
+
+using VRegList = std::vector<VReg>;
+
+
+// A peephole rule rewrites the instructions starting at 'i' in place
+// and returns true if it fired
+struct PeepholeRule {
+  const char* name_;
+  std::function<bool(InstList& insts, size_t i)> apply_;
+  int count_;
+};
+
+using PeepholeRuleList = std::vector<PeepholeRule>;
+
+
 struct StaticInitializer {
   int offset_;
   int width_;
@@ -107,6 +163,8 @@ public:
   virtual void VisitDeclaration(Declaration* init);
   virtual void VisitEmptyStmt(EmptyStmt* emptyStmt);
   virtual void VisitIfStmt(IfStmt* ifStmt);
+  virtual void VisitSwitchStmt(SwitchStmt* switchStmt);
+  virtual void VisitLoopStmt(LoopStmt* loopStmt);
   virtual void VisitJumpStmt(JumpStmt* jumpStmt);
   virtual void VisitReturnStmt(ReturnStmt* returnStmt);
   virtual void VisitLabelStmt(LabelStmt* labelStmt);
@@ -122,13 +180,17 @@ public:
   }
 
   void Gen();
+  static void DumpPeepholeStats(FILE* fp);
+  // A frame slot or static object that is not volatile
+  static bool IsPlainSlot(const std::string& operand);
 
 protected:
   // Binary
   void GenCommaOp(BinaryOp* comma);
   void GenMemberRefOp(BinaryOp* binaryOp);
-  void GenAndOp(BinaryOp* binaryOp);
-  void GenOrOp(BinaryOp* binaryOp);
+  void GenLogicalOp(BinaryOp* logicalOp);
+  void GenBranch(Expr* expr, bool when, const LabelStmt* label);
+  std::string GenOperands(BinaryOp* binary);
   void GenAddOp(BinaryOp* binaryOp);
   void GenSubOp(BinaryOp* binaryOp);
   void GenAssignOp(BinaryOp* assign);
@@ -136,10 +198,26 @@ protected:
   void GenDerefOp(UnaryOp* deref);
   void GenMinusOp(UnaryOp* minus);
   void GenPointerArithm(BinaryOp* binary);
-  void GenDivOp(bool flt, bool sign, int width, int op);
-  void GenMulOp(int width, bool flt, bool sign);
-  void GenCompOp(int width, bool flt, const char* set);
+  bool ShouldInline(FuncDef* funcDef, FuncCall* funcCall);
+  bool GenInline(FuncCall* funcCall);
+  bool GenTailCall(FuncCall* funcCall);
+  void GenCall(FuncCall* funcCall, bool tail);
+  void GenVectorLoop(LoopStmt* loopStmt);
+  bool MatchVectorExpr(Expr* expr, VectorLoop& loop, int depth);
+  std::string GenVectorExpr(Expr* expr, VectorLoop& loop, int depth);
+  static Object* VectorArray(Expr* expr, Object* index);
+  static bool IsIncrement(Expr* expr, Object* obj);
+  static bool IsSimpleExpr(Expr* expr);
+  void GenDivOp(bool flt, bool sign, int width, int op,
+                const std::string& src);
+  bool GenDivImm(bool sign, int width, int op, long imm);
+  void GenMulOp(int width, bool flt, const std::string& src);
+  void GenCmp(int width, bool flt, const std::string& src);
+  void GenCompOp(int width, bool flt, const char* set,
+                 const std::string& src);
   void GenCompZero(Type* type);
+  void GenCaseTree(const CaseList& cases, size_t begin, size_t end,
+                   int width, bool sign, const LabelStmt* defaultLabel);
 
   // Unary
   void GenIncDec(Expr* operand, bool postfix, const std::string& inst);
@@ -148,6 +226,7 @@ protected:
                                   InitList::iterator end, int offset);
 
   void GenStaticDecl(Declaration* decl);
+  void EmitStaticInit(const StaticInitializer& staticInit);
 
   void GenSaveArea();
   void GenBuiltin(FuncCall* funcCall);
@@ -156,6 +235,7 @@ protected:
       const FuncDef::ParamList& params=FuncDef::ParamList());
 
   void CopyStruct(ObjectAddr desAddr, int width);
+  void EmitStringTail(int width, bool zero);
 
   std::string ConsLabel(Constant* cons);
 
@@ -164,7 +244,7 @@ protected:
       int& overflow, FuncType* funcType);
 
   void Emit(const std::string& str) {
-    fprintf(outFile_, "\t%s\n", str.c_str());
+    Output("\t" + str);
   }
 
   void Emit(const std::string& inst,
@@ -186,7 +266,7 @@ protected:
 
   void Emit(const std::string& inst,
             const LabelStmt* label) {
-    Emit(inst + "\t" + label->Repr());
+    Emit(inst, LabelRepr(label));
   }
 
   void Emit(const std::string& inst,
@@ -207,13 +287,21 @@ protected:
     Emit(inst, src.Repr(), des);
   }
 
+  void Output(const std::string& line);
   void EmitLabel(const std::string& label);
+  // The labels of an inlined body are renamed by a suffix
+  static std::string LabelRepr(const LabelStmt* label) {
+    return label->Repr() + labelSuffix_;
+  }
   void EmitZero(ObjectAddr addr, int width);
   void EmitLoad(const std::string& addr, Type* type);
   void EmitLoad(const std::string& addr, int width, bool flt);
+  void EmitExtend(int width, bool sign);
+  void SetRaxExt(int zero, int sign) { raxZeroExt_ = zero, raxSignExt_ = sign; }
   void EmitStore(const ObjectAddr& addr, Type* type);
   void EmitStore(const std::string& addr, Type* type);
   void EmitStore(const std::string& addr, int width, bool flt);
+  void EmitLoadOperand(const std::string& operand, int width, bool flt);
   void EmitLoadBitField(const std::string& addr, Object* bitField);
   void EmitStoreBitField(const ObjectAddr& addr, Type* type);
   void EmitLoc(Expr* expr);
@@ -230,11 +318,25 @@ protected:
 
   void Exchange(bool flt);
 
+  void PushTemp(const std::string& reg);
+  void PopTemp(const std::string& reg);
+  bool PromoteLocals(FuncDef* funcDef);
+  int NewVReg(int offset, Type* type);
+  std::string VRegName(int idx) { return "%v" + std::to_string(idx); }
+  void AllocRegs();
+  void Peephole();
+  void LayoutFrame();
+  static bool OmitFrame();
+  void FlushFunc();
+
 protected:
   static const std::string* last_file;
   static Parser* parser_;
   static FILE* outFile_;
   static RODataList rodatas_;
+  // Labels of the float and string literals of the translation unit,
+  // by width and value
+  static std::map<std::string, std::string> consLabels_;
   static int offset_;
 
   // The address that store the register %rdi,
@@ -243,6 +345,42 @@ protected:
   static FuncDef* curFunc_;
 
   static std::vector<Declaration*> staticDecls_;
+
+  // Instructions of the current function, buffered with -O1
+  static InstList insts_;
+  static VRegList vregs_;
+  static std::vector<int> tempStack_;
+  static std::set<Object*> promoted_;
+  static std::map<Object*, int> localVRegs_;
+  static int prologueEnd_;
+  static int calleeSaveOffset_;
+
+  // Frame slots and labels of the volatile objects the current
+  // function accesses, the peephole rules leave them alone
+  static std::map<int, int> volatileSlots_;
+  static std::set<std::string> volatileLabels_;
+  static PeepholeRuleList peepholeRules_;
+
+  // The function definitions of the translation unit by name,
+  // and those being inlined
+  static std::map<std::string, FuncDef*> funcDefs_;
+  static std::set<FuncDef*> inlining_;
+  // Where the returns of the inlined body jump to
+  static std::string inlineExit_;
+  static std::string labelSuffix_;
+
+  // The upper bits of %rax extend its low 'raxZeroExt_' bytes with zeros,
+  // or its low 'raxSignExt_' bytes with their sign; 0 if not known.
+  // Each emitted line forgets them, unless set right after it.
+  static int raxZeroExt_;
+  static int raxSignExt_;
+
+  // Whether the calls in tail position of the current function may jump
+  static bool tailCalls_;
+  // Whether the current function makes calls, and passes arguments on
+  // the stack to them
+  static bool makesCalls_;
+  static bool stackArgs_;
 };
 
 
@@ -271,4 +409,44 @@ private:
   ObjectAddr addr_ {"", "", 0};
 };
 
+
+/*
+ * Selects the operand of an expression that needs no instructions:
+ * an immediate, or a scalar object of 'width' bytes in memory or in
+ * a virtual register. Other expressions have no operand.
+ * Without a width, it only computes the Sethi-Ullman number, that is
+ * how many registers the expression needs.
+ */
+class OperandGenerator: public Generator {
+public:
+  explicit OperandGenerator(int width=0): width_(width) {}
+
+  // Expression
+  virtual void VisitBinaryOp(BinaryOp* binaryOp);
+  virtual void VisitUnaryOp(UnaryOp* unaryOp);
+  virtual void VisitConditionalOp(ConditionalOp* condOp);
+  virtual void VisitFuncCall(FuncCall* funcCall) { need_ = 2; }
+  virtual void VisitObject(Object* obj);
+  virtual void VisitEnumerator(Enumerator* enumer);
+  virtual void VisitIdentifier(Identifier* ident) {}
+  virtual void VisitConstant(Constant* cons);
+  virtual void VisitTempVar(TempVar* tempVar) {}
+
+  std::string GenExpr(Expr* expr) {
+    expr->Accept(this);
+    return operand_;
+  }
+
+  static int Need(Expr* expr) {
+    OperandGenerator gen;
+    expr->Accept(&gen);
+    return gen.need_;
+  }
+
+private:
+  int width_;
+  std::string operand_;
+  int need_ {1};
+};
+
 #endif
@@ -4,6 +4,8 @@
 #include "code_gen.h"
 #include "token.h"
 
+#include <climits>
+
 
 template<typename T>
 void Evaluator<T>::VisitBinaryOp(BinaryOp* binary) {
@@ -149,7 +151,7 @@ void Evaluator<Addr>::VisitBinaryOp(BinaryOp* binary) {
   case '.': {
     addr_.label_ = l.label_;
     auto type = binary->lhs_->Type()->ToStruct();
-    auto offset = type->GetMember(binary->rhs_->tok_->str_)->Offset();
+    auto offset = type->GetField(binary->rhs_->tok_->str_)->offset_;
     addr_.offset_ = l.offset_ + offset;
     break;
   }
@@ -201,10 +203,408 @@ void Evaluator<Addr>::VisitConstant(Constant* cons)  {
   if (cons->Type()->IsInteger()) {
     addr_ = {"", static_cast<int>(cons->IVal())};
   } else if (cons->Type()->ToArray()) {
-    Generator().ConsLabel(cons); // Add the literal to rodatas_.
-    addr_.label_ = Generator::rodatas_.back().label_;
+    // Add the literal to rodatas_
+    addr_.label_ = Generator().ConsLabel(cons);
     addr_.offset_ = 0;
   } else {
     assert(false);
   }
 }
+
+
+/*
+ * ConstantFolder
+ */
+
+// Complex numbers have no constants
+static bool IsFoldable(Type* type) {
+  auto arithm = type->ToArithm();
+  return arithm && !arithm->IsComplex();
+}
+
+
+// Integers are kept sign or zero extended from their width,
+// just as the generator loads them.
+static Constant* NewConstant(const Token* tok, Type* type, long val) {
+  auto arithm = type->ToArithm();
+  int bits = arithm->Width() * 8;
+  if (arithm->IsBool()) {
+    val = val != 0;
+  } else if (bits < 64 && arithm->IsUnsigned()) {
+    val &= (1L << bits) - 1;
+  } else if (bits < 64) {
+    auto shift = 64 - bits;
+    val = static_cast<long>(static_cast<unsigned long>(val) << shift) >> shift;
+  }
+  return Constant::New(tok, arithm->Tag(), val);
+}
+
+
+static Constant* NewConstant(const Token* tok, Type* type, double val) {
+  auto arithm = type->ToArithm();
+  if (arithm->Width() == 4)
+    val = static_cast<float>(val);
+  return Constant::New(tok, arithm->Tag(), val);
+}
+
+
+static bool IsTrue(Constant* cons) {
+  if (cons->Type()->IsFloat())
+    return cons->FVal() != 0;
+  return cons->IVal() != 0;
+}
+
+
+void ConstantFolder::VisitFuncDef(FuncDef* funcDef) {
+  // Every new constant local may turn more initializers into constants
+  size_t size;
+  do {
+    size = consts_.size();
+    Fold(funcDef->body_);
+    for (auto& init: inits_) {
+      if (!written_.count(init.first))
+        consts_.insert(init);
+    }
+  } while (consts_.size() > size);
+}
+
+
+Expr* ConstantFolder::Fold(Expr* expr, bool lval) {
+  lval_ = lval;
+  expr->Accept(this);
+  return static_cast<Expr*>(stmt_);
+}
+
+
+Stmt* ConstantFolder::Fold(Stmt* stmt) {
+  // EmptyStmt does not visit
+  stmt_ = stmt;
+  lval_ = label_ = jump_ = false;
+  stmt->Accept(this);
+  return stmt_;
+}
+
+
+// Evaluates 'expr' whose operands are constants,
+// in the domain of 'type': long or double.
+Expr* ConstantFolder::Eval(Expr* expr, Type* type) {
+  if (type->IsFloat()) {
+    auto val = Evaluator<double>().Eval(expr);
+    if (expr->Type()->IsFloat())
+      return NewConstant(expr->Tok(), expr->Type(), val);
+    return NewConstant(expr->Tok(), expr->Type(), static_cast<long>(val));
+  }
+  auto val = Evaluator<long>().Eval(expr);
+  return NewConstant(expr->Tok(), expr->Type(), val);
+}
+
+
+void ConstantFolder::VisitBinaryOp(BinaryOp* binary) {
+  auto op = binary->op_;
+  if (op == '.') {
+    binary->lhs_ = Fold(binary->lhs_, lval_);
+    stmt_ = binary;
+    return;
+  }
+
+  binary->lhs_ = Fold(binary->lhs_, op == '=');
+  binary->rhs_ = Fold(binary->rhs_);
+  stmt_ = binary;
+
+  auto type = binary->Type();
+  auto lhs = binary->lhs_->ToConstant();
+  auto rhs = binary->rhs_->ToConstant();
+  if (lhs && !IsFoldable(lhs->Type()))
+    lhs = nullptr;
+  if (rhs && !IsFoldable(rhs->Type()))
+    rhs = nullptr;
+  if (op == '=' || !IsFoldable(type))
+    return;
+  if (op == ',') {
+    if (lhs) stmt_ = binary->rhs_;
+    return;
+  }
+
+  // The right operand is not evaluated
+  if (lhs && op == Token::LOGICAL_AND && !IsTrue(lhs)) {
+    stmt_ = NewConstant(binary->Tok(), type, 0L);
+    return;
+  } else if (lhs && op == Token::LOGICAL_OR && IsTrue(lhs)) {
+    stmt_ = NewConstant(binary->Tok(), type, 1L);
+    return;
+  }
+
+  if (lhs && rhs) {
+    auto domain = lhs->Type()->IsFloat() ? lhs->Type(): rhs->Type();
+    auto l = lhs->IVal(), r = rhs->IVal();
+    // The long arithmetic of Evaluator is signed
+    bool neg = domain->IsUnsigned() && domain->Width() == 8 && (l < 0 || r < 0);
+    if (domain->IsFloat()) {
+      if (op == '/' && rhs->FVal() == 0)
+        return;
+    } else switch (op) {
+    case '/': case '%':
+      if (r == 0 || (r == -1 && l == LONG_MIN) || neg)
+        return;
+      break;
+    case Token::LEFT: case Token::RIGHT:
+      if (r < 0 || r >= lhs->Type()->Width() * 8)
+        return;
+      if (op == Token::RIGHT && lhs->Type()->IsUnsigned() && l < 0)
+        return;
+      break;
+    case '<': case '>': case Token::LE: case Token::GE:
+      if (neg) return;
+      break;
+    default: break;
+    }
+    stmt_ = Eval(binary, domain);
+    return;
+  }
+
+  // Neutral elements, -0.0 makes them unsafe for floats
+  if (!type->IsInteger())
+    return;
+  if (rhs && binary->lhs_->Type() == type) {
+    auto r = rhs->IVal();
+    switch (op) {
+    case '+': case '-': case '|': case '^':
+    case Token::LEFT: case Token::RIGHT:
+      if (r == 0) stmt_ = binary->lhs_;
+      break;
+    case '*': case '/':
+      if (r == 1) stmt_ = binary->lhs_;
+      break;
+    default: break;
+    }
+  } else if (lhs && binary->rhs_->Type() == type) {
+    auto l = lhs->IVal();
+    switch (op) {
+    case '+': case '|': case '^':
+      if (l == 0) stmt_ = binary->rhs_;
+      break;
+    case '*':
+      if (l == 1) stmt_ = binary->rhs_;
+      break;
+    default: break;
+    }
+  }
+}
+
+
+void ConstantFolder::VisitUnaryOp(UnaryOp* unary) {
+  auto op = unary->op_;
+  bool lval = op == Token::ADDR ||
+              op == Token::PREFIX_INC || op == Token::PREFIX_DEC ||
+              op == Token::POSTFIX_INC || op == Token::POSTFIX_DEC;
+  unary->operand_ = Fold(unary->operand_, lval);
+  stmt_ = unary;
+
+  auto type = unary->Type();
+  auto operand = unary->operand_->ToConstant();
+  if (!operand || !IsFoldable(operand->Type()) || !IsFoldable(type))
+    return;
+
+  auto from = operand->Type();
+  switch (op) {
+  case Token::PLUS: case Token::MINUS: case '~': case '!':
+    stmt_ = Eval(unary, from);
+    break;
+  case Token::CAST:
+    if (from->IsFloat() && type->IsBool()) {
+      stmt_ = NewConstant(unary->Tok(), type, static_cast<long>(IsTrue(operand)));
+    } else if (from->IsFloat() && type->IsInteger()) {
+      // Conversions out of range are left to the runtime
+      auto val = operand->FVal();
+      if (val > -9.2e18 && val < 9.2e18 &&
+          !(type->IsUnsigned() && type->Width() == 8))
+        stmt_ = Eval(unary, type);
+    } else if (!(from->IsUnsigned() && from->Width() == 8 &&
+                 operand->IVal() < 0 && type->IsFloat())) {
+      stmt_ = Eval(unary, type);
+    }
+    break;
+  default: break;
+  }
+}
+
+
+void ConstantFolder::VisitConditionalOp(ConditionalOp* condOp) {
+  condOp->cond_ = Fold(condOp->cond_);
+  condOp->exprTrue_ = Fold(condOp->exprTrue_);
+  condOp->exprFalse_ = Fold(condOp->exprFalse_);
+  stmt_ = condOp;
+
+  auto cond = condOp->cond_->ToConstant();
+  if (!cond || !IsFoldable(cond->Type()))
+    return;
+  auto expr = IsTrue(cond) ? condOp->exprTrue_: condOp->exprFalse_;
+  if (expr->Type() == condOp->Type())
+    stmt_ = expr;
+}
+
+
+void ConstantFolder::VisitFuncCall(FuncCall* funcCall) {
+  funcCall->designator_ = Fold(funcCall->designator_);
+  for (auto& arg: funcCall->args_)
+    arg = Fold(arg);
+  stmt_ = funcCall;
+}
+
+
+void ConstantFolder::VisitEnumerator(Enumerator* enumer) {
+  stmt_ = enumer->cons_;
+}
+
+
+// Float literals keep their double value until they are emitted
+void ConstantFolder::VisitConstant(Constant* cons) {
+  stmt_ = cons;
+  auto type = cons->Type();
+  if (type->IsFloat() && IsFoldable(type) && type->Width() == 4 &&
+      cons->FVal() != static_cast<float>(cons->FVal()))
+    stmt_ = NewConstant(cons->Tok(), type, cons->FVal());
+}
+
+
+void ConstantFolder::VisitObject(Object* obj) {
+  stmt_ = obj;
+  if (lval_) {
+    written_.insert(obj);
+  } else {
+    auto iter = consts_.find(obj);
+    if (iter != consts_.end())
+      stmt_ = iter->second;
+  }
+}
+
+
+void ConstantFolder::VisitDeclaration(Declaration* decl) {
+  auto obj = decl->obj_;
+  // All its uses are replaced by the constant
+  stmt_ = consts_.count(obj) ? nullptr: decl;
+  if (!stmt_ || obj->IsStatic())
+    return;
+
+  for (auto& init: decl->inits_)
+    init.expr_ = Fold(init.expr_);
+  stmt_ = decl;
+
+  auto type = obj->Type();
+  if (obj->Anonymous() || obj->IsVolatileQualified() ||
+      !IsFoldable(type) || decl->inits_.size() != 1)
+    return;
+  auto cons = decl->inits_.begin()->expr_->ToConstant();
+  if (cons && cons->Type() == type)
+    inits_[obj] = cons;
+}
+
+
+void ConstantFolder::VisitIfStmt(IfStmt* ifStmt) {
+  ifStmt->cond_ = Fold(ifStmt->cond_);
+  auto then = Fold(ifStmt->then_);
+  bool thenLabel = label_, thenJump = jump_;
+  Stmt* els = nullptr;
+  bool elseLabel = false, elseJump = false;
+  if (ifStmt->else_) {
+    els = Fold(ifStmt->else_);
+    elseLabel = label_, elseJump = jump_;
+  }
+  ifStmt->then_ = then ? then: EmptyStmt::New();
+  ifStmt->else_ = els;
+  stmt_ = ifStmt;
+  label_ = thenLabel || elseLabel;
+  jump_ = then && thenJump && els && elseJump;
+
+  // A dead branch with a label may still be entered by a jump
+  auto cond = ifStmt->cond_->ToConstant();
+  if (!cond || !IsFoldable(cond->Type()))
+    return;
+  if (IsTrue(cond) && !elseLabel) {
+    stmt_ = then;
+    jump_ = then && thenJump;
+  } else if (!IsTrue(cond) && !thenLabel) {
+    stmt_ = els;
+    jump_ = els && elseJump;
+  }
+}
+
+
+// A switch on a constant jumps straight to its case
+void ConstantFolder::VisitSwitchStmt(SwitchStmt* switchStmt) {
+  switchStmt->cond_ = Fold(switchStmt->cond_);
+  stmt_ = switchStmt;
+  jump_ = true;
+
+  auto cond = switchStmt->cond_->ToConstant();
+  if (!cond)
+    return;
+  auto label = switchStmt->default_;
+  for (const auto& item: switchStmt->cases_) {
+    if (item.first == cond->IVal())
+      label = item.second;
+  }
+  stmt_ = JumpStmt::New(label);
+}
+
+
+void ConstantFolder::VisitLoopStmt(LoopStmt* loopStmt) {
+  if (loopStmt->cond_)
+    loopStmt->cond_ = Fold(loopStmt->cond_);
+  if (loopStmt->step_)
+    loopStmt->step_ = Fold(loopStmt->step_);
+  auto body = Fold(loopStmt->body_);
+  loopStmt->body_ = body ? body: EmptyStmt::New();
+  stmt_ = loopStmt;
+  jump_ = false;
+
+  // A loop that never runs may still be entered by a jump into its body
+  auto cond = loopStmt->cond_ ? loopStmt->cond_->ToConstant(): nullptr;
+  if (!cond || !IsFoldable(cond->Type()))
+    return;
+  if (IsTrue(cond))
+    loopStmt->cond_ = nullptr;
+  else if (!loopStmt->doWhile_ && !label_)
+    stmt_ = nullptr;
+}
+
+
+void ConstantFolder::VisitJumpStmt(JumpStmt* jumpStmt) {
+  stmt_ = jumpStmt;
+  jump_ = true;
+}
+
+
+void ConstantFolder::VisitReturnStmt(ReturnStmt* returnStmt) {
+  if (returnStmt->expr_)
+    returnStmt->expr_ = Fold(returnStmt->expr_);
+  stmt_ = returnStmt;
+  jump_ = true;
+}
+
+
+void ConstantFolder::VisitLabelStmt(LabelStmt* labelStmt) {
+  stmt_ = labelStmt;
+  label_ = true;
+}
+
+
+void ConstantFolder::VisitCompoundStmt(CompoundStmt* compStmt) {
+  StmtList stmts;
+  bool label = false, jump = false;
+  for (auto stmt: compStmt->stmts_) {
+    auto folded = Fold(stmt);
+    // Nothing reaches the statements after a jump, up to the next label
+    if (jump && !label_)
+      continue;
+    label = label || label_;
+    if (folded) {
+      stmts.push_back(folded);
+      jump = jump_;
+    }
+  }
+  compStmt->stmts_.swap(stmts);
+  stmt_ = compStmt;
+  label_ = label;
+  jump_ = jump;
+}
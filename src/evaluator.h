@@ -5,6 +5,9 @@
 #include "error.h"
 #include "visitor.h"
 
+#include <map>
+#include <set>
+
 
 class Expr;
 
@@ -45,6 +48,8 @@ public:
   // We may should assert here
   virtual void VisitDeclaration(Declaration* init) {}
   virtual void VisitIfStmt(IfStmt* ifStmt) {}
+  virtual void VisitSwitchStmt(SwitchStmt* switchStmt) {}
+  virtual void VisitLoopStmt(LoopStmt* loopStmt) {}
   virtual void VisitJumpStmt(JumpStmt* jumpStmt) {}
   virtual void VisitReturnStmt(ReturnStmt* returnStmt) {}
   virtual void VisitLabelStmt(LabelStmt* labelStmt) {}
@@ -100,6 +105,8 @@ public:
   // We may should assert here
   virtual void VisitDeclaration(Declaration* init) {}
   virtual void VisitIfStmt(IfStmt* ifStmt) {}
+  virtual void VisitSwitchStmt(SwitchStmt* switchStmt) {}
+  virtual void VisitLoopStmt(LoopStmt* loopStmt) {}
   virtual void VisitJumpStmt(JumpStmt* jumpStmt) {}
   virtual void VisitReturnStmt(ReturnStmt* returnStmt) {}
   virtual void VisitLabelStmt(LabelStmt* labelStmt) {}
@@ -117,4 +124,58 @@ private:
   Addr addr_;
 };
 
+
+/*
+ * With -O1, folds the constant subexpressions of a function with the
+ * arithmetic of Evaluator, propagates the constant initializers of locals
+ * that are never written again, and removes unreachable statements.
+ */
+class ConstantFolder: public Visitor {
+public:
+  ConstantFolder() {}
+  virtual ~ConstantFolder() {}
+
+  virtual void VisitBinaryOp(BinaryOp* binary);
+  virtual void VisitUnaryOp(UnaryOp* unary);
+  virtual void VisitConditionalOp(ConditionalOp* condOp);
+  virtual void VisitFuncCall(FuncCall* funcCall);
+  virtual void VisitEnumerator(Enumerator* enumer);
+  virtual void VisitIdentifier(Identifier* ident) { stmt_ = ident; }
+  virtual void VisitObject(Object* obj);
+  virtual void VisitConstant(Constant* cons);
+  virtual void VisitTempVar(TempVar* tempVar) { stmt_ = tempVar; }
+
+  virtual void VisitDeclaration(Declaration* decl);
+  virtual void VisitIfStmt(IfStmt* ifStmt);
+  virtual void VisitSwitchStmt(SwitchStmt* switchStmt);
+  virtual void VisitLoopStmt(LoopStmt* loopStmt);
+  virtual void VisitJumpStmt(JumpStmt* jumpStmt);
+  virtual void VisitReturnStmt(ReturnStmt* returnStmt);
+  virtual void VisitLabelStmt(LabelStmt* labelStmt);
+  virtual void VisitEmptyStmt(EmptyStmt* emptyStmt) { stmt_ = emptyStmt; }
+  virtual void VisitCompoundStmt(CompoundStmt* compStmt);
+  virtual void VisitFuncDef(FuncDef* funcDef);
+  virtual void VisitTranslationUnit(TranslationUnit* unit) {}
+
+  void Fold(FuncDef* funcDef) { VisitFuncDef(funcDef); }
+
+private:
+  Expr* Fold(Expr* expr, bool lval=false);
+  Stmt* Fold(Stmt* stmt);
+  Expr* Eval(Expr* expr, Type* type);
+
+  // The replacement of the visited node, nullptr to remove a statement
+  Stmt* stmt_;
+  // The visited expression is the target of an assignment, '&' or '++'
+  bool lval_ {false};
+  // The visited statement contains a label, so it may be reached by a jump
+  bool label_ {false};
+  // Control does not fall through the visited statement
+  bool jump_ {false};
+
+  std::set<Object*> written_;
+  std::map<Object*, Constant*> inits_;
+  std::map<Object*, Constant*> consts_;
+};
+
 #endif
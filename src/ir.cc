@@ -0,0 +1,1421 @@
+#include "ir.h"
+
+#include "mem_pool.h"
+#include "parser.h"
+#include "token.h"
+
+#include <algorithm>
+#include <functional>
+
+
+static MemPoolImp<IRValue>  irValuePool;
+static MemPoolImp<IRBlock>  irBlockPool;
+static MemPoolImp<IRFunc>   irFuncPool;
+
+IRFunc* IRBuilder::func_ = nullptr;
+IRBlock* IRBuilder::cur_ = nullptr;
+int IRBuilder::allocaEnd_ = 0;
+std::map<Expr*, IRValue*> IRBuilder::slots_;
+std::map<LabelStmt*, IRBlock*> IRBuilder::labels_;
+std::set<Object*> IRBuilder::anonyDecls_;
+IRFuncList IRBuilder::funcs_;
+
+
+static const char* opNames[] = {
+  "const", "fconst", "string", "global", "param",
+  "alloca", "load", "store", "copy", "zero", "ptradd",
+  "add", "sub", "mul", "div", "udiv", "rem", "urem",
+  "and", "or", "xor", "shl", "sar", "shr", "neg", "not",
+  "eq", "ne", "lt", "le", "gt", "ge", "ult", "ule", "ugt", "uge",
+  "trunc", "sext", "zext", "ftoi", "itof", "fext", "ftrunc", "bitcast",
+  "call", "vastart", "vaarg", "phi",
+  "br", "condbr", "ret",
+};
+
+
+static const char* typeNames[] = {
+  "void", "i8", "i16", "i32", "i64", "f32", "f64", "ptr"
+};
+
+
+static const char* OpName(IROp op) {
+  return opNames[static_cast<int>(op)];
+}
+
+
+static const char* TypeName(IRType type) {
+  return typeNames[static_cast<int>(type)];
+}
+
+
+static bool IsInt(IRType type) {
+  return type >= IRType::I8 && type <= IRType::I64;
+}
+
+
+static bool IsFlt(IRType type) {
+  return type == IRType::F32 || type == IRType::F64;
+}
+
+
+static int WidthOf(IRType type) {
+  switch (type) {
+  case IRType::I8: return 1;
+  case IRType::I16: return 2;
+  case IRType::I32: case IRType::F32: return 4;
+  case IRType::I64: case IRType::F64: case IRType::PTR: return 8;
+  default: return 0;
+  }
+}
+
+
+static IRType ToIRType(Type* type) {
+  if (type->ToVoid())
+    return IRType::VOID;
+  if (type->IsFloat())
+    return type->Width() == 4 ? IRType::F32: IRType::F64;
+  if (type->IsInteger()) {
+    switch (type->Width()) {
+    case 1: return IRType::I8;
+    case 2: return IRType::I16;
+    case 4: return IRType::I32;
+    default: return IRType::I64;
+    }
+  }
+  // Pointers, arrays, functions and struct/union, by address
+  return IRType::PTR;
+}
+
+
+/*
+ * IR objects
+ */
+
+IRValue* IRValue::New(IROp op, IRType type) {
+  auto ret = new (irValuePool.Alloc()) IRValue();
+  ret->op_ = op;
+  ret->type_ = type;
+  return ret;
+}
+
+
+IRBlock* IRBlock::New() {
+  return new (irBlockPool.Alloc()) IRBlock();
+}
+
+
+IRFunc* IRFunc::New(const std::string& name, IRType retType) {
+  auto ret = new (irFuncPool.Alloc()) IRFunc();
+  ret->name_ = name;
+  ret->retType_ = retType;
+  return ret;
+}
+
+
+void IRFunc::ComputeCFG() {
+  for (auto block: blocks_) {
+    block->preds_.clear();
+    block->succs_.clear();
+  }
+  for (auto block: blocks_) {
+    auto term = block->Terminator();
+    if (term == nullptr)
+      continue;
+    for (auto succ: term->blocks_) {
+      block->succs_.push_back(succ);
+      succ->preds_.push_back(block);
+    }
+  }
+}
+
+
+// Drop the blocks that can't be reached from the entry,
+// like the code after a 'goto' or 'return'.
+void IRFunc::RemoveUnreachable() {
+  std::set<IRBlock*> reached;
+  std::vector<IRBlock*> worklist {blocks_.front()};
+  while (worklist.size()) {
+    auto block = worklist.back();
+    worklist.pop_back();
+    if (!reached.insert(block).second)
+      continue;
+    auto term = block->Terminator();
+    if (term)
+      worklist.insert(worklist.end(), term->blocks_.begin(), term->blocks_.end());
+  }
+
+  auto end = std::remove_if(blocks_.begin(), blocks_.end(),
+      [&reached](IRBlock* block) { return !reached.count(block); });
+  blocks_.erase(end, blocks_.end());
+
+  for (auto block: blocks_) {
+    for (auto inst: block->insts_) {
+      if (inst->op_ != IROp::PHI)
+        break;
+      for (size_t i = 0; i < inst->blocks_.size();) {
+        if (reached.count(inst->blocks_[i])) {
+          ++i;
+          continue;
+        }
+        inst->blocks_.erase(inst->blocks_.begin() + i);
+        inst->operands_.erase(inst->operands_.begin() + i);
+      }
+    }
+  }
+  ComputeCFG();
+}
+
+
+static IRBlock* Intersect(IRBlock* lhs, IRBlock* rhs) {
+  while (lhs != rhs) {
+    while (lhs->rpo_ > rhs->rpo_)
+      lhs = lhs->idom_;
+    while (rhs->rpo_ > lhs->rpo_)
+      rhs = rhs->idom_;
+  }
+  return lhs;
+}
+
+
+/*
+ * The iterative algorithm of Cooper, Harvey and Kennedy,
+ * over the reverse postorder of the reachable blocks.
+ */
+void IRFunc::ComputeDominators() {
+  std::vector<IRBlock*> postorder;
+  std::set<IRBlock*> visited;
+  std::vector<std::pair<IRBlock*, size_t>> stack;
+  for (auto block: blocks_) {
+    block->idom_ = nullptr;
+    block->rpo_ = -1;
+  }
+  stack.push_back({blocks_.front(), 0});
+  visited.insert(blocks_.front());
+  while (stack.size()) {
+    auto& top = stack.back();
+    if (top.second < top.first->succs_.size()) {
+      auto succ = top.first->succs_[top.second++];
+      if (visited.insert(succ).second)
+        stack.push_back({succ, 0});
+      continue;
+    }
+    postorder.push_back(top.first);
+    stack.pop_back();
+  }
+
+  std::vector<IRBlock*> rpo(postorder.rbegin(), postorder.rend());
+  for (size_t i = 0; i < rpo.size(); ++i)
+    rpo[i]->rpo_ = i;
+
+  auto entry = rpo.front();
+  entry->idom_ = entry;
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t i = 1; i < rpo.size(); ++i) {
+      IRBlock* idom = nullptr;
+      for (auto pred: rpo[i]->preds_) {
+        if (pred->idom_ == nullptr)
+          continue;
+        idom = idom ? Intersect(pred, idom): pred;
+      }
+      if (idom != rpo[i]->idom_) {
+        rpo[i]->idom_ = idom;
+        changed = true;
+      }
+    }
+  }
+}
+
+
+bool IRFunc::Dominates(IRBlock* dom, IRBlock* block) const {
+  if (block->idom_ == nullptr)
+    return false;
+  while (block != dom) {
+    if (block->idom_ == block)
+      return false;
+    block = block->idom_;
+  }
+  return true;
+}
+
+
+/*
+ * Slots of scalars that are only loaded and stored with one type.
+ * The address of such a slot never escapes.
+ */
+std::set<IRValue*> IRFunc::PromotableSlots() {
+  std::map<IRValue*, IRType> types;
+  std::set<IRValue*> escaped;
+  for (auto inst: blocks_.front()->insts_) {
+    if (inst->op_ == IROp::ALLOCA)
+      types[inst] = IRType::VOID;
+  }
+
+  auto access = [&types, &escaped](IRValue* slot, IRType type) {
+    auto& slotType = types[slot];
+    if (slotType != IRType::VOID && slotType != type)
+      escaped.insert(slot);
+    slotType = type;
+  };
+  for (auto block: blocks_) {
+    for (auto inst: block->insts_) {
+      for (size_t i = 0; i < inst->operands_.size(); ++i) {
+        auto operand = inst->operands_[i];
+        if (!types.count(operand))
+          continue;
+        if (inst->op_ == IROp::LOAD)
+          access(operand, inst->type_);
+        else if (inst->op_ == IROp::STORE && i == 1)
+          access(operand, inst->operands_[0]->type_);
+        else
+          escaped.insert(operand);
+      }
+    }
+  }
+
+  std::set<IRValue*> ret;
+  for (const auto& slot: types) {
+    auto type = slot.second;
+    if (escaped.count(slot.first) || type == IRType::VOID)
+      continue;
+    // A scalar must fill its whole slot
+    if (WidthOf(type) != slot.first->ival_)
+      continue;
+    ret.insert(slot.first);
+  }
+  return ret;
+}
+
+
+/*
+ * Promotes the slots that never escape to SSA values, placing phis
+ * at the iterated dominance frontiers of the stores (Cytron et al.).
+ * A load that is not reached by any store reads zero.
+ */
+void IRFunc::Mem2Reg() {
+  auto slots = PromotableSlots();
+  if (slots.empty())
+    return;
+  ComputeCFG();
+  ComputeDominators();
+
+  std::map<IRBlock*, std::set<IRBlock*>> frontiers;
+  std::map<IRBlock*, std::vector<IRBlock*>> children;
+  for (auto block: blocks_) {
+    if (block->idom_ != block)
+      children[block->idom_].push_back(block);
+    if (block->preds_.size() < 2)
+      continue;
+    for (auto pred: block->preds_) {
+      for (auto runner = pred; runner != block->idom_;
+           runner = runner->idom_) {
+        frontiers[runner].insert(block);
+      }
+    }
+  }
+
+  std::map<IRValue*, IRValue*> phiSlots;
+  for (auto slot: slots) {
+    std::vector<IRBlock*> worklist;
+    IRType type = IRType::VOID;
+    for (auto block: blocks_) {
+      for (auto inst: block->insts_) {
+        if (inst->op_ == IROp::STORE && inst->operands_[1] == slot) {
+          worklist.push_back(block);
+          type = inst->operands_[0]->type_;
+        }
+      }
+    }
+    std::set<IRBlock*> placed;
+    while (worklist.size()) {
+      auto block = worklist.back();
+      worklist.pop_back();
+      for (auto frontier: frontiers[block]) {
+        if (!placed.insert(frontier).second)
+          continue;
+        auto phi = IRValue::New(IROp::PHI, type);
+        phi->block_ = frontier;
+        phi->operands_.resize(frontier->preds_.size());
+        phi->blocks_ = frontier->preds_;
+        frontier->insts_.insert(frontier->insts_.begin(), phi);
+        phiSlots[phi] = slot;
+        worklist.push_back(frontier);
+      }
+    }
+  }
+
+  std::map<IRValue*, IRValue*> replaced;
+  auto resolve = [&replaced](IRValue* val) {
+    for (auto iter = replaced.find(val); iter != replaced.end();
+         iter = replaced.find(val)) {
+      val = iter->second;
+    }
+    return val;
+  };
+  std::map<IRValue*, std::vector<IRValue*>> stacks;
+  auto current = [&stacks](IRValue* slot, IRType type) {
+    auto& stack = stacks[slot];
+    if (stack.size())
+      return stack.back();
+    return IRValue::New(IsFlt(type) ? IROp::FCONST: IROp::CONST, type);
+  };
+
+  // Renames along the dominator tree
+  std::function<void(IRBlock*)> rename = [&](IRBlock* block) {
+    std::vector<IRValue*> pushed;
+    for (auto inst: block->insts_) {
+      if (inst->op_ == IROp::PHI && phiSlots.count(inst)) {
+        stacks[phiSlots[inst]].push_back(inst);
+        pushed.push_back(phiSlots[inst]);
+      } else if (inst->op_ == IROp::LOAD && slots.count(inst->operands_[0])) {
+        replaced[inst] = current(inst->operands_[0], inst->type_);
+      } else if (inst->op_ == IROp::STORE && slots.count(inst->operands_[1])) {
+        stacks[inst->operands_[1]].push_back(resolve(inst->operands_[0]));
+        pushed.push_back(inst->operands_[1]);
+      }
+    }
+    for (auto succ: block->succs_) {
+      for (auto inst: succ->insts_) {
+        if (inst->op_ != IROp::PHI)
+          break;
+        if (!phiSlots.count(inst))
+          continue;
+        for (size_t i = 0; i < inst->blocks_.size(); ++i) {
+          if (inst->blocks_[i] == block)
+            inst->operands_[i] = current(phiSlots[inst], inst->type_);
+        }
+      }
+    }
+    for (auto child: children[block])
+      rename(child);
+    for (auto slot: pushed)
+      stacks[slot].pop_back();
+  };
+  rename(blocks_.front());
+
+  for (auto block: blocks_) {
+    auto end = std::remove_if(block->insts_.begin(), block->insts_.end(),
+        [&slots, &replaced](IRValue* inst) {
+      return replaced.count(inst) || slots.count(inst)
+          || (inst->op_ == IROp::STORE && slots.count(inst->operands_[1]));
+    });
+    block->insts_.erase(end, block->insts_.end());
+    for (auto inst: block->insts_) {
+      for (auto& operand: inst->operands_)
+        operand = resolve(operand);
+    }
+  }
+  for (auto iter = slots_.begin(); iter != slots_.end();) {
+    if (slots.count(iter->second))
+      iter = slots_.erase(iter);
+    else
+      ++iter;
+  }
+
+  // Drop the phis nobody uses
+  for (bool changed = true; changed;) {
+    changed = false;
+    std::set<IRValue*> used;
+    for (auto block: blocks_) {
+      for (auto inst: block->insts_) {
+        for (auto operand: inst->operands_) {
+          if (operand != inst)
+            used.insert(operand);
+        }
+      }
+    }
+    for (auto block: blocks_) {
+      auto end = std::remove_if(block->insts_.begin(), block->insts_.end(),
+          [&used](IRValue* inst) {
+        return inst->op_ == IROp::PHI && !used.count(inst);
+      });
+      changed = changed || end != block->insts_.end();
+      block->insts_.erase(end, block->insts_.end());
+    }
+  }
+}
+
+
+/*
+ * Verifier
+ */
+
+static void VerifyError(IRFunc* func, IRBlock* block,
+                        IRValue* inst, const char* msg) {
+  auto op = inst ? OpName(inst->op_): "";
+  Error("IR verification failed in '%s', block %d, '%s': %s",
+        func->name_.c_str(), block->id_, op, msg);
+}
+
+
+static bool VerifyTypes(IRFunc* func, IRValue* inst) {
+  auto& ops = inst->operands_;
+  auto type = inst->type_;
+  auto operandType = [&ops](size_t i) {
+    return i < ops.size() ? ops[i]->type_: IRType::VOID;
+  };
+  for (auto operand: ops) {
+    if (operand == nullptr)
+      return false;
+  }
+
+  switch (inst->op_) {
+  case IROp::ALLOCA:
+    return ops.size() == 0 && type == IRType::PTR && inst->ival_ > 0;
+  case IROp::LOAD:
+    return ops.size() == 1 && operandType(0) == IRType::PTR
+        && type != IRType::VOID;
+  case IROp::STORE:
+    return ops.size() == 2 && operandType(1) == IRType::PTR
+        && operandType(0) != IRType::VOID;
+  case IROp::COPY:
+    return ops.size() == 2 && operandType(0) == IRType::PTR
+        && operandType(1) == IRType::PTR;
+  case IROp::ZERO:
+    return ops.size() == 1 && operandType(0) == IRType::PTR;
+  case IROp::PTRADD:
+    return ops.size() == 2 && type == IRType::PTR
+        && operandType(0) == IRType::PTR && operandType(1) == IRType::I64;
+
+  case IROp::ADD: case IROp::SUB: case IROp::MUL: case IROp::DIV:
+    return ops.size() == 2 && operandType(0) == type
+        && operandType(1) == type && (IsInt(type) || IsFlt(type));
+  case IROp::UDIV: case IROp::REM: case IROp::UREM:
+  case IROp::AND: case IROp::OR: case IROp::XOR:
+  case IROp::SHL: case IROp::SAR: case IROp::SHR:
+    return ops.size() == 2 && operandType(0) == type
+        && operandType(1) == type && IsInt(type);
+  case IROp::NEG:
+    return ops.size() == 1 && operandType(0) == type
+        && (IsInt(type) || IsFlt(type));
+  case IROp::NOT:
+    return ops.size() == 1 && operandType(0) == type && IsInt(type);
+
+  case IROp::EQ: case IROp::NE: case IROp::LT: case IROp::LE:
+  case IROp::GT: case IROp::GE: case IROp::ULT: case IROp::ULE:
+  case IROp::UGT: case IROp::UGE:
+    return ops.size() == 2 && operandType(0) == operandType(1)
+        && operandType(0) != IRType::VOID && IsInt(type);
+
+  case IROp::TRUNC:
+    return ops.size() == 1 && IsInt(type) && IsInt(operandType(0))
+        && WidthOf(type) < WidthOf(operandType(0));
+  case IROp::SEXT: case IROp::ZEXT:
+    return ops.size() == 1 && IsInt(type) && IsInt(operandType(0))
+        && WidthOf(type) > WidthOf(operandType(0));
+  case IROp::FTOI:
+    return ops.size() == 1 && IsInt(type) && IsFlt(operandType(0));
+  case IROp::ITOF:
+    return ops.size() == 1 && IsFlt(type) && IsInt(operandType(0));
+  case IROp::FEXT:
+    return ops.size() == 1 && type == IRType::F64
+        && operandType(0) == IRType::F32;
+  case IROp::FTRUNC:
+    return ops.size() == 1 && type == IRType::F32
+        && operandType(0) == IRType::F64;
+  case IROp::BITCAST:
+    return ops.size() == 1 && type != operandType(0)
+        && WidthOf(type) == 8 && WidthOf(operandType(0)) == 8
+        && !IsFlt(type) && !IsFlt(operandType(0));
+
+  case IROp::CALL:
+    return ops.size() >= 1 && operandType(0) == IRType::PTR;
+  case IROp::VASTART:
+    return ops.size() == 1 && operandType(0) == IRType::PTR;
+  case IROp::VAARG:
+    return ops.size() == 1 && operandType(0) == IRType::PTR
+        && type == IRType::PTR;
+  case IROp::PHI:
+    for (auto operand: ops) {
+      if (operand->type_ != type)
+        return false;
+    }
+    return type != IRType::VOID;
+
+  case IROp::BR:
+    return ops.size() == 0 && inst->blocks_.size() == 1;
+  case IROp::CONDBR:
+    return ops.size() == 1 && IsInt(operandType(0))
+        && inst->blocks_.size() == 2;
+  case IROp::RET:
+    if (func->retType_ == IRType::VOID)
+      return ops.size() == 0;
+    return ops.size() == 1 && operandType(0) == func->retType_;
+
+  default:
+    return false;
+  }
+}
+
+
+/*
+ * Checks the structure of blocks, the types of the operands
+ * and that every definition dominates its uses.
+ */
+void IRFunc::Verify() {
+  if (blocks_.empty())
+    Error("IR verification failed in '%s': no entry block", name_.c_str());
+  for (size_t i = 0; i < blocks_.size(); ++i)
+    blocks_[i]->id_ = i;
+
+  std::set<IRBlock*> blockSet(blocks_.begin(), blocks_.end());
+  std::map<IRValue*, int> position;
+  for (auto block: blocks_) {
+    if (block->Terminator() == nullptr)
+      VerifyError(this, block, nullptr, "missing terminator");
+    bool phis = true;
+    for (size_t i = 0; i < block->insts_.size(); ++i) {
+      auto inst = block->insts_[i];
+      if (inst->block_ != block)
+        VerifyError(this, block, inst, "wrong parent block");
+      if (!inst->IsInst())
+        VerifyError(this, block, inst, "not an instruction");
+      if (inst->IsTerminator() && i + 1 != block->insts_.size())
+        VerifyError(this, block, inst, "terminator in the middle of block");
+      if (inst->op_ == IROp::PHI && !phis)
+        VerifyError(this, block, inst, "phi after other instructions");
+      phis = phis && inst->op_ == IROp::PHI;
+      for (auto target: inst->blocks_) {
+        if (!blockSet.count(target))
+          VerifyError(this, block, inst, "reference to a foreign block");
+      }
+      if (!VerifyTypes(this, inst))
+        VerifyError(this, block, inst, "mismatched operands");
+      position[inst] = i;
+    }
+  }
+
+  ComputeCFG();
+  ComputeDominators();
+  for (auto block: blocks_) {
+    if (block != blocks_.front() && block->idom_ == nullptr)
+      VerifyError(this, block, nullptr, "unreachable block");
+    if (block == blocks_.front() && block->preds_.size())
+      VerifyError(this, block, nullptr, "entry block has predecessors");
+
+    for (auto inst: block->insts_) {
+      if (inst->op_ == IROp::PHI) {
+        auto incoming = inst->blocks_;
+        auto preds = block->preds_;
+        std::sort(incoming.begin(), incoming.end());
+        std::sort(preds.begin(), preds.end());
+        if (incoming != preds)
+          VerifyError(this, block, inst, "phi does not match predecessors");
+      }
+
+      for (size_t i = 0; i < inst->operands_.size(); ++i) {
+        auto def = inst->operands_[i];
+        if (def->op_ == IROp::PARAM) {
+          if (std::find(params_.begin(), params_.end(), def) == params_.end())
+            VerifyError(this, block, inst, "use of a foreign parameter");
+          continue;
+        }
+        if (!def->IsInst())
+          continue;
+        if (!position.count(def))
+          VerifyError(this, block, inst, "use of a foreign instruction");
+        if (def->type_ == IRType::VOID)
+          VerifyError(this, block, inst, "use of a void value");
+
+        // The incoming value of phi is used at the end of the predecessor
+        auto useBlock = inst->op_ == IROp::PHI ? inst->blocks_[i]: block;
+        bool dominated;
+        if (def->block_ == useBlock && inst->op_ != IROp::PHI)
+          dominated = position[def] < position[inst];
+        else
+          dominated = Dominates(def->block_, useBlock);
+        if (!dominated)
+          VerifyError(this, block, inst, "definition does not dominate use");
+      }
+    }
+  }
+}
+
+
+/*
+ * Dump
+ */
+
+static std::string Escape(const std::string& str) {
+  std::string ret;
+  for (unsigned char c: str) {
+    if (c == '"' || c == '\\') {
+      ret += '\\';
+      ret += c;
+    } else if (isprint(c)) {
+      ret += c;
+    } else {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\%03o", c);
+      ret += buf;
+    }
+  }
+  return ret;
+}
+
+
+static std::string ValueRepr(IRValue* val) {
+  std::string ret = TypeName(val->type_);
+  ret += " ";
+  switch (val->op_) {
+  case IROp::CONST:
+    return ret + (val->type_ == IRType::PTR && val->ival_ == 0
+        ? "null": std::to_string(val->ival_));
+  case IROp::FCONST: {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%g", val->fval_);
+    return ret + buf;
+  }
+  case IROp::STRING: return ret + "\"" + Escape(val->name_) + "\"";
+  case IROp::GLOBAL: return ret + "@" + val->name_;
+  default: return ret + "%" + std::to_string(val->id_);
+  }
+}
+
+
+static std::string BlockRepr(IRBlock* block) {
+  return "bb" + std::to_string(block->id_);
+}
+
+
+void IRFunc::Dump(FILE* fp) {
+  int id = 0;
+  for (size_t i = 0; i < blocks_.size(); ++i)
+    blocks_[i]->id_ = i;
+
+  std::string line = "define " + std::string(TypeName(retType_)) +
+                     " @" + name_ + "(";
+  for (size_t i = 0; i < params_.size(); ++i) {
+    params_[i]->id_ = id++;
+    line += (i ? ", ": "") + ValueRepr(params_[i]);
+  }
+  fprintf(fp, "%s) {\n", line.c_str());
+
+  for (auto block: blocks_) {
+    for (auto inst: block->insts_) {
+      if (inst->type_ != IRType::VOID)
+        inst->id_ = id++;
+    }
+  }
+
+  for (auto block: blocks_) {
+    fprintf(fp, "%s:\n", BlockRepr(block).c_str());
+    for (auto inst: block->insts_) {
+      line = "  ";
+      if (inst->type_ != IRType::VOID) {
+        line += "%" + std::to_string(inst->id_) + " = ";
+        line += std::string(TypeName(inst->type_)) + " ";
+      }
+      line += OpName(inst->op_);
+
+      std::string sep = " ";
+      if (inst->op_ == IROp::PHI) {
+        for (size_t i = 0; i < inst->operands_.size(); ++i) {
+          line += sep + "[" + ValueRepr(inst->operands_[i]) + ", " +
+                  BlockRepr(inst->blocks_[i]) + "]";
+          sep = ", ";
+        }
+      } else {
+        for (auto operand: inst->operands_) {
+          line += sep + ValueRepr(operand);
+          sep = ", ";
+        }
+        for (auto target: inst->blocks_) {
+          line += sep + BlockRepr(target);
+          sep = ", ";
+        }
+      }
+
+      switch (inst->op_) {
+      case IROp::ALLOCA:
+        line += sep + std::to_string(inst->ival_) + ", align " +
+                std::to_string(inst->align_);
+        break;
+      case IROp::COPY: case IROp::ZERO:
+        line += sep + std::to_string(inst->ival_);
+        break;
+      case IROp::VAARG:
+        line += sep + inst->name_ + " " + std::to_string(inst->ival_);
+        break;
+      default: break;
+      }
+      fprintf(fp, "%s\n", line.c_str());
+    }
+  }
+  fprintf(fp, "}\n\n");
+}
+
+
+/*
+ * Builder
+ */
+
+IRValue* IRBuilder::Emit(IROp op, IRType type,
+                         const std::vector<IRValue*>& operands) {
+  // Code after a jump is unreachable, give it a block anyway
+  if (cur_ == nullptr)
+    Place(IRBlock::New());
+  auto inst = IRValue::New(op, type);
+  inst->operands_ = operands;
+  inst->block_ = cur_;
+  cur_->insts_.push_back(inst);
+  if (inst->IsTerminator())
+    cur_ = nullptr;
+  return inst;
+}
+
+
+IRValue* IRBuilder::Const(IRType type, long val) {
+  if (IsFlt(type)) {
+    auto cons = IRValue::New(IROp::FCONST, type);
+    cons->fval_ = val;
+    return cons;
+  }
+  auto cons = IRValue::New(IROp::CONST, type);
+  cons->ival_ = val;
+  return cons;
+}
+
+
+IRValue* IRBuilder::Zero(IRType type) {
+  return Const(type, 0);
+}
+
+
+// Converts between integers and pointers of different width
+IRValue* IRBuilder::Coerce(IRValue* val, IRType type) {
+  auto from = val->type_;
+  if (from == type || type == IRType::VOID)
+    return val;
+  if (from == IRType::PTR)
+    return Coerce(Emit(IROp::BITCAST, IRType::I64, {val}), type);
+  if (type == IRType::PTR)
+    return Emit(IROp::BITCAST, type, {Coerce(val, IRType::I64)});
+  if (IsFlt(from) && IsFlt(type))
+    return Emit(from == IRType::F32 ? IROp::FEXT: IROp::FTRUNC, type, {val});
+  if (IsFlt(from))
+    return Emit(IROp::FTOI, type, {val});
+  if (IsFlt(type))
+    return Emit(IROp::ITOF, type, {val});
+  auto op = WidthOf(from) > WidthOf(type) ? IROp::TRUNC: IROp::SEXT;
+  return Emit(op, type, {val});
+}
+
+
+// Extends the integer 'val' of C type 'type' by its signedness
+IRValue* IRBuilder::Extend(IRValue* val, Type* type, IRType to) {
+  if (IsInt(val->type_) && WidthOf(val->type_) < WidthOf(to)) {
+    auto op = type->IsUnsigned() ? IROp::ZEXT: IROp::SEXT;
+    auto wide = IsInt(to) ? to: IRType::I64;
+    return Coerce(Emit(op, wide, {val}), to);
+  }
+  return Coerce(val, to);
+}
+
+
+// The truth value of 'expr', as 0 or 1 of type int
+IRValue* IRBuilder::Cond(Expr* expr) {
+  auto val = GenExpr(expr);
+  if (val->IsCompare() && val->type_ == IRType::I32)
+    return val;
+  return Emit(IROp::NE, IRType::I32, {val, Zero(val->type_)});
+}
+
+
+IRValue* IRBuilder::Load(const IRAddr& addr, Type* type) {
+  auto irType = ToIRType(type);
+  auto val = Emit(IROp::LOAD, irType, {addr.ptr_});
+  if (addr.bitFieldWidth_ == 0)
+    return val;
+
+  int bits = WidthOf(irType) * 8;
+  auto left = bits - addr.bitFieldBegin_ - addr.bitFieldWidth_;
+  auto right = bits - addr.bitFieldWidth_;
+  auto shiftRight = type->IsUnsigned() ? IROp::SHR: IROp::SAR;
+  val = Emit(IROp::SHL, irType, {val, Const(irType, left)});
+  return Emit(shiftRight, irType, {val, Const(irType, right)});
+}
+
+
+void IRBuilder::Store(const IRAddr& addr, IRValue* val, Type* type) {
+  auto irType = ToIRType(type);
+  val = Coerce(val, irType);
+  if (addr.bitFieldWidth_ != 0) {
+    auto mask = Object::BitFieldMask(addr.bitFieldBegin_,
+                                     addr.bitFieldWidth_);
+    auto old = Emit(IROp::LOAD, irType, {addr.ptr_});
+    old = Emit(IROp::AND, irType, {old, Const(irType, ~mask)});
+    if (addr.bitFieldBegin_)
+      val = Emit(IROp::SHL, irType, {val, Const(irType, addr.bitFieldBegin_)});
+    val = Emit(IROp::AND, irType, {val, Const(irType, mask)});
+    val = Emit(IROp::OR, irType, {old, val});
+  }
+  Emit(IROp::STORE, IRType::VOID, {val, addr.ptr_});
+}
+
+
+// The stack slot of a local object or temporary, allocated in the entry
+IRValue* IRBuilder::Slot(Expr* expr, int align) {
+  auto iter = slots_.find(expr);
+  if (iter != slots_.end())
+    return iter->second;
+
+  auto alloca = IRValue::New(IROp::ALLOCA, IRType::PTR);
+  alloca->ival_ = std::max(expr->Type()->Width(), 1);
+  alloca->align_ = align;
+  auto entry = func_->blocks_.front();
+  alloca->block_ = entry;
+  entry->insts_.insert(entry->insts_.begin() + allocaEnd_++, alloca);
+  slots_[expr] = alloca;
+  return alloca;
+}
+
+
+IRValue* IRBuilder::Slot(Object* obj) {
+  auto slot = Slot(obj, obj->Align());
+  func_->slots_[obj] = slot;
+  return slot;
+}
+
+
+IRBlock* IRBuilder::LabelBlock(LabelStmt* label) {
+  auto& block = labels_[label];
+  if (block == nullptr)
+    block = IRBlock::New();
+  return block;
+}
+
+
+// Starts emitting into 'block', falling through from the current block
+void IRBuilder::Place(IRBlock* block) {
+  if (cur_)
+    Br(block);
+  func_->blocks_.push_back(block);
+  cur_ = block;
+}
+
+
+void IRBuilder::Br(IRBlock* block) {
+  if (cur_ == nullptr)
+    return;
+  auto br = Emit(IROp::BR, IRType::VOID);
+  br->blocks_ = {block};
+}
+
+
+void IRBuilder::CondBr(IRValue* cond, IRBlock* then, IRBlock* els) {
+  auto br = Emit(IROp::CONDBR, IRType::VOID, {cond});
+  br->blocks_ = {then, els};
+}
+
+
+void IRBuilder::VisitBinaryOp(BinaryOp* binary) {
+  auto op = binary->op_;
+  if (op == '=')
+    return GenAssignOp(binary);
+  if (op == Token::LOGICAL_AND || op == Token::LOGICAL_OR)
+    return GenLogicalOp(binary);
+  if (op == '.') {
+    auto addr = IRLValBuilder().GenAddr(binary);
+    val_ = binary->Type()->IsScalar() ? Load(addr, binary->Type()): addr.ptr_;
+    return;
+  }
+  if (op == ',') {
+    GenExpr(binary->lhs_);
+    GenExpr(binary->rhs_);
+    return;
+  }
+  if (binary->lhs_->Type()->ToPointer() && (op == '+' || op == '-'))
+    return GenPointerArithm(binary);
+
+  auto type = binary->lhs_->Type();
+  auto irType = ToIRType(type);
+  auto flt = type->IsFloat();
+  auto sign = !type->IsUnsigned() && !type->ToPointer();
+
+  auto lhs = Coerce(GenExpr(binary->lhs_), irType);
+  auto rhs = Coerce(GenExpr(binary->rhs_), irType);
+
+  IROp inst;
+  switch (op) {
+  case '*': inst = IROp::MUL; break;
+  case '/': inst = (flt || sign) ? IROp::DIV: IROp::UDIV; break;
+  case '%': inst = sign ? IROp::REM: IROp::UREM; break;
+  case '+': inst = IROp::ADD; break;
+  case '-': inst = IROp::SUB; break;
+  case '|': inst = IROp::OR; break;
+  case '&': inst = IROp::AND; break;
+  case '^': inst = IROp::XOR; break;
+  case Token::LEFT: inst = IROp::SHL; break;
+  case Token::RIGHT: inst = sign ? IROp::SAR: IROp::SHR; break;
+  case '<': inst = (flt || sign) ? IROp::LT: IROp::ULT; break;
+  case '>': inst = (flt || sign) ? IROp::GT: IROp::UGT; break;
+  case Token::LE: inst = (flt || sign) ? IROp::LE: IROp::ULE; break;
+  case Token::GE: inst = (flt || sign) ? IROp::GE: IROp::UGE; break;
+  case Token::EQ: inst = IROp::EQ; break;
+  case Token::NE: inst = IROp::NE; break;
+  default: assert(false); return;
+  }
+  // The type of a comparison is int, whatever the operands are
+  auto cmp = inst >= IROp::EQ && inst <= IROp::UGE;
+  val_ = Emit(inst, cmp ? ToIRType(binary->Type()): irType, {lhs, rhs});
+}
+
+
+void IRBuilder::GenAssignOp(BinaryOp* assign) {
+  auto addr = IRLValBuilder().GenAddr(assign->lhs_);
+  auto val = GenExpr(assign->rhs_);
+  if (assign->Type()->IsScalar()) {
+    Store(addr, val, assign->Type());
+    val_ = val;
+  } else {
+    auto copy = Emit(IROp::COPY, IRType::VOID, {addr.ptr_, val});
+    copy->ival_ = assign->Type()->Width();
+    val_ = addr.ptr_;
+  }
+}
+
+
+void IRBuilder::GenLogicalOp(BinaryOp* logicalOp) {
+  auto isAnd = logicalOp->op_ == Token::LOGICAL_AND;
+  auto rhsBlock = IRBlock::New();
+  auto endBlock = IRBlock::New();
+
+  auto lhs = Cond(logicalOp->lhs_);
+  auto lhsEnd = cur_;
+  if (isAnd)
+    CondBr(lhs, rhsBlock, endBlock);
+  else
+    CondBr(lhs, endBlock, rhsBlock);
+
+  Place(rhsBlock);
+  auto rhs = Cond(logicalOp->rhs_);
+  auto rhsEnd = cur_;
+  Br(endBlock);
+
+  Place(endBlock);
+  auto phi = Emit(IROp::PHI, IRType::I32,
+                  {Const(IRType::I32, isAnd ? 0: 1), rhs});
+  phi->blocks_ = {lhsEnd, rhsEnd};
+  val_ = phi;
+}
+
+
+void IRBuilder::GenPointerArithm(BinaryOp* binary) {
+  // The pointer is always the lhs
+  auto lhs = GenExpr(binary->lhs_);
+  auto rhs = GenExpr(binary->rhs_);
+  auto width = binary->lhs_->Type()->ToPointer()->Derived()->Width();
+  width = std::max(width, 1);
+
+  if (binary->rhs_->Type()->ToPointer()) {
+    lhs = Coerce(lhs, IRType::I64);
+    rhs = Coerce(rhs, IRType::I64);
+    val_ = Emit(IROp::SUB, IRType::I64, {lhs, rhs});
+    if (width > 1)
+      val_ = Emit(IROp::DIV, IRType::I64, {val_, Const(IRType::I64, width)});
+    return;
+  }
+
+  auto offset = Extend(rhs, binary->rhs_->Type(), IRType::I64);
+  if (binary->op_ == '-')
+    width = -width;
+  if (width != 1)
+    offset = Emit(IROp::MUL, IRType::I64, {offset, Const(IRType::I64, width)});
+  val_ = Emit(IROp::PTRADD, IRType::PTR, {lhs, offset});
+}
+
+
+void IRBuilder::VisitUnaryOp(UnaryOp* unary) {
+  switch (unary->op_) {
+  case Token::PREFIX_INC:
+    return GenIncDec(unary->operand_, false, IROp::ADD);
+  case Token::PREFIX_DEC:
+    return GenIncDec(unary->operand_, false, IROp::SUB);
+  case Token::POSTFIX_INC:
+    return GenIncDec(unary->operand_, true, IROp::ADD);
+  case Token::POSTFIX_DEC:
+    return GenIncDec(unary->operand_, true, IROp::SUB);
+  case Token::ADDR:
+    val_ = IRLValBuilder().GenAddr(unary->operand_).ptr_;
+    return;
+  case Token::DEREF: {
+    auto ptr = GenExpr(unary->operand_);
+    val_ = unary->Type()->IsScalar() ? Load({ptr}, unary->Type()): ptr;
+  } return;
+  case Token::PLUS:
+    GenExpr(unary->operand_);
+    return;
+  case Token::MINUS: {
+    auto val = GenExpr(unary->operand_);
+    val_ = Emit(IROp::NEG, val->type_, {val});
+  } return;
+  case '~': {
+    auto val = GenExpr(unary->operand_);
+    val_ = Emit(IROp::NOT, val->type_, {val});
+  } return;
+  case '!': {
+    auto val = GenExpr(unary->operand_);
+    val_ = Emit(IROp::EQ, IRType::I32, {val, Zero(val->type_)});
+  } return;
+  case Token::CAST:
+    return GenCastOp(unary);
+  default: assert(false);
+  }
+}
+
+
+void IRBuilder::GenIncDec(Expr* operand, bool postfix, IROp op) {
+  auto type = operand->Type();
+  auto irType = ToIRType(type);
+  auto addr = IRLValBuilder().GenAddr(operand);
+  auto val = Load(addr, type);
+
+  IRValue* res;
+  auto pointerType = type->ToPointer();
+  if (pointerType) {
+    long width = std::max(pointerType->Derived()->Width(), 1);
+    auto offset = Const(IRType::I64, op == IROp::ADD ? width: -width);
+    res = Emit(IROp::PTRADD, IRType::PTR, {val, offset});
+  } else {
+    res = Emit(op, irType, {val, Const(irType, 1)});
+  }
+  Store(addr, res, type);
+  val_ = postfix ? val: res;
+}
+
+
+void IRBuilder::GenCastOp(UnaryOp* cast) {
+  auto desType = cast->Type();
+  auto srcType = cast->operand_->Type();
+  auto val = GenExpr(cast->operand_);
+  auto irType = ToIRType(desType);
+
+  if (desType->ToVoid()) {
+    val_ = val;
+  } else if (desType->IsBool()) {
+    val_ = Emit(IROp::NE, IRType::I8, {val, Zero(val->type_)});
+  } else if (srcType->IsInteger()) {
+    // Integers are extended to 64 bits before converted to
+    // floats or pointers, the signedness of unsigned is kept
+    auto wide = desType->IsInteger() ? irType: IRType::I64;
+    val_ = Coerce(Extend(val, srcType, wide), irType);
+  } else {
+    val_ = Coerce(val, irType);
+  }
+}
+
+
+void IRBuilder::VisitConditionalOp(ConditionalOp* condOp) {
+  auto irType = ToIRType(condOp->Type());
+  auto thenBlock = IRBlock::New();
+  auto elseBlock = IRBlock::New();
+  auto endBlock = IRBlock::New();
+
+  CondBr(Cond(condOp->cond_), thenBlock, elseBlock);
+  Place(thenBlock);
+  auto trueVal = Coerce(GenExpr(condOp->exprTrue_), irType);
+  auto thenEnd = cur_;
+  Br(endBlock);
+  Place(elseBlock);
+  auto falseVal = Coerce(GenExpr(condOp->exprFalse_), irType);
+  auto elseEnd = cur_;
+  Place(endBlock);
+
+  if (irType == IRType::VOID) {
+    val_ = nullptr;
+    return;
+  }
+  auto phi = Emit(IROp::PHI, irType, {trueVal, falseVal});
+  phi->blocks_ = {thenEnd, elseEnd};
+  val_ = phi;
+}
+
+
+void IRBuilder::GenBuiltin(FuncCall* funcCall) {
+  auto ap = GenExpr(funcCall->args_[0]);
+  if (funcCall->FuncType() == Parser::vaStartType_) {
+    val_ = Emit(IROp::VASTART, IRType::VOID, {ap});
+    return;
+  }
+
+  auto argType = funcCall->args_[1]->Type()->ToPointer()->Derived();
+  val_ = Emit(IROp::VAARG, IRType::PTR, {ap});
+  val_->ival_ = argType->Width();
+  if (argType->IsInteger() || argType->ToPointer())
+    val_->name_ = "int";
+  else if (argType->IsFloat())
+    val_->name_ = "sse";
+  else
+    val_->name_ = "mem";
+}
+
+
+void IRBuilder::VisitFuncCall(FuncCall* funcCall) {
+  if (Parser::IsBuiltin(funcCall->FuncType()))
+    return GenBuiltin(funcCall);
+
+  std::vector<IRValue*> operands;
+  operands.push_back(IRLValBuilder().GenAddr(funcCall->Designator()).ptr_);
+  for (auto arg: funcCall->args_)
+    operands.push_back(GenExpr(arg));
+  val_ = Emit(IROp::CALL, ToIRType(funcCall->Type()), operands);
+}
+
+
+void IRBuilder::VisitObject(Object* obj) {
+  auto addr = IRLValBuilder().GenAddr(obj);
+  val_ = obj->Type()->IsScalar() ? Load(addr, obj->Type()): addr.ptr_;
+}
+
+
+void IRBuilder::VisitEnumerator(Enumerator* enumer) {
+  val_ = Const(IRType::I32, enumer->Val());
+}
+
+
+// Ident must be function
+void IRBuilder::VisitIdentifier(Identifier* ident) {
+  val_ = IRLValBuilder().GenAddr(ident).ptr_;
+}
+
+
+void IRBuilder::VisitConstant(Constant* cons) {
+  auto irType = ToIRType(cons->Type());
+  if (cons->Type()->IsFloat()) {
+    val_ = IRValue::New(IROp::FCONST, irType);
+    val_->fval_ = cons->FVal();
+  } else if (cons->Type()->IsInteger()) {
+    val_ = Const(irType, cons->IVal());
+  } else {
+    val_ = IRValue::New(IROp::STRING, IRType::PTR);
+    val_->name_ = *cons->SVal();
+  }
+}
+
+
+void IRBuilder::VisitTempVar(TempVar* tempVar) {
+  val_ = Load({Slot(tempVar, tempVar->Type()->Align())}, tempVar->Type());
+}
+
+
+void IRBuilder::VisitDeclaration(Declaration* decl) {
+  auto obj = decl->obj_;
+  if (obj->IsStatic() || !obj->HasInit())
+    return;
+
+  auto slot = Slot(obj);
+  auto addrAt = [this, slot](int offset) {
+    if (offset == 0)
+      return slot;
+    return Emit(IROp::PTRADD, IRType::PTR, {slot, Const(IRType::I64, offset)});
+  };
+  auto zero = [this, &addrAt](int begin, int end) {
+    if (begin >= end)
+      return;
+    auto inst = Emit(IROp::ZERO, IRType::VOID, {addrAt(begin)});
+    inst->ival_ = end - begin;
+  };
+
+  int lastEnd = 0;
+  for (const auto& init: decl->Inits()) {
+    zero(lastEnd, init.offset_);
+    auto val = GenExpr(init.expr_);
+    IRAddr addr {addrAt(init.offset_), init.bitFieldBegin_,
+                 init.bitFieldWidth_};
+    if (init.type_->IsScalar()) {
+      Store(addr, val, init.type_);
+    } else {
+      auto copy = Emit(IROp::COPY, IRType::VOID, {addr.ptr_, val});
+      copy->ival_ = init.type_->Width();
+    }
+    lastEnd = std::max(lastEnd, init.offset_ + init.type_->Width());
+  }
+  zero(lastEnd, obj->Type()->Width());
+}
+
+
+void IRBuilder::VisitIfStmt(IfStmt* ifStmt) {
+  auto thenBlock = IRBlock::New();
+  auto elseBlock = ifStmt->else_ ? IRBlock::New(): nullptr;
+  auto endBlock = IRBlock::New();
+
+  CondBr(Cond(ifStmt->cond_), thenBlock, elseBlock ? elseBlock: endBlock);
+  Place(thenBlock);
+  Visit(ifStmt->then_);
+  if (elseBlock) {
+    Br(endBlock);
+    Place(elseBlock);
+    Visit(ifStmt->else_);
+  }
+  Place(endBlock);
+}
+
+
+void IRBuilder::VisitSwitchStmt(SwitchStmt* switchStmt) {
+  auto val = GenExpr(switchStmt->cond_);
+  for (const auto& item: switchStmt->cases_) {
+    auto next = IRBlock::New();
+    auto eq = Emit(IROp::EQ, IRType::I32, {val, Const(val->type_, item.first)});
+    CondBr(eq, LabelBlock(item.second), next);
+    Place(next);
+  }
+  Br(LabelBlock(switchStmt->default_));
+}
+
+
+void IRBuilder::VisitLoopStmt(LoopStmt* loopStmt) {
+  auto bodyBlock = IRBlock::New();
+  auto endBlock = LabelBlock(loopStmt->break_);
+  if (loopStmt->cond_ && !loopStmt->doWhile_)
+    CondBr(Cond(loopStmt->cond_), bodyBlock, endBlock);
+  Place(bodyBlock);
+  Visit(loopStmt->body_);
+  Place(LabelBlock(loopStmt->continue_));
+  if (loopStmt->step_)
+    GenExpr(loopStmt->step_);
+  if (loopStmt->cond_)
+    CondBr(Cond(loopStmt->cond_), bodyBlock, endBlock);
+  else
+    Br(bodyBlock);
+  Place(endBlock);
+}
+
+
+void IRBuilder::VisitJumpStmt(JumpStmt* jumpStmt) {
+  Br(LabelBlock(jumpStmt->label_));
+}
+
+
+void IRBuilder::VisitLabelStmt(LabelStmt* labelStmt) {
+  Place(LabelBlock(labelStmt));
+}
+
+
+void IRBuilder::VisitReturnStmt(ReturnStmt* returnStmt) {
+  std::vector<IRValue*> operands;
+  if (returnStmt->expr_) {
+    auto val = GenExpr(returnStmt->expr_);
+    if (func_->retType_ != IRType::VOID)
+      operands.push_back(Coerce(val, func_->retType_));
+  }
+  Emit(IROp::RET, IRType::VOID, operands);
+}
+
+
+void IRBuilder::VisitCompoundStmt(CompoundStmt* compStmt) {
+  for (auto stmt: compStmt->stmts_)
+    Visit(stmt);
+}
+
+
+void IRBuilder::VisitFuncDef(FuncDef* funcDef) {
+  auto funcType = funcDef->FuncType();
+  func_ = IRFunc::New(funcDef->Name(), ToIRType(funcType->Derived().GetPtr()));
+  slots_.clear();
+  labels_.clear();
+  allocaEnd_ = 0;
+  cur_ = nullptr;
+  Place(IRBlock::New());
+
+  // Scalar params are stored to their slots, so that they can be
+  // assigned. Aggregates are passed by address.
+  for (auto param: funcType->Params()) {
+    auto val = IRValue::New(IROp::PARAM, ToIRType(param->Type()));
+    func_->params_.push_back(val);
+    if (param->Type()->IsScalar())
+      Store({Slot(param)}, val, param->Type());
+    else
+      slots_[param] = val;
+  }
+
+  Visit(funcDef->Body());
+
+  // Falling off the end returns an unspecified value
+  if (cur_) {
+    std::vector<IRValue*> operands;
+    if (func_->retType_ != IRType::VOID)
+      operands.push_back(Zero(func_->retType_));
+    Emit(IROp::RET, IRType::VOID, operands);
+  }
+  func_->RemoveUnreachable();
+  funcs_.push_back(func_);
+}
+
+
+void IRBuilder::VisitTranslationUnit(TranslationUnit* unit) {
+  // Objects of file scope are referenced by name
+  for (auto extDecl: unit->ExtDecls())
+    Visit(extDecl);
+}
+
+
+IRFuncList IRBuilder::Build(TranslationUnit* unit) {
+  funcs_.clear();
+  VisitTranslationUnit(unit);
+  return funcs_;
+}
+
+
+IRFunc* IRBuilder::Build(FuncDef* funcDef) {
+  VisitFuncDef(funcDef);
+  funcs_.pop_back();
+  return func_;
+}
+
+
+void IRLValBuilder::VisitBinaryOp(BinaryOp* binary) {
+  if (binary->op_ != '.') {
+    // Struct/union rvalues, like the result of an assignment
+    addr_ = {IRBuilder().GenExpr(binary)};
+    return;
+  }
+
+  addr_ = IRLValBuilder().GenAddr(binary->lhs_);
+  const auto& name = binary->rhs_->Tok()->str_;
+  auto field = binary->lhs_->Type()->ToStruct()->GetField(name);
+  if (field->offset_ != 0) {
+    auto offset = Const(IRType::I64, field->offset_);
+    addr_.ptr_ = Emit(IROp::PTRADD, IRType::PTR, {addr_.ptr_, offset});
+  }
+  addr_.bitFieldBegin_ = field->bitFieldBegin_;
+  addr_.bitFieldWidth_ = field->bitFieldWidth_;
+}
+
+
+void IRLValBuilder::VisitUnaryOp(UnaryOp* unary) {
+  if (unary->op_ != Token::DEREF) {
+    addr_ = {IRBuilder().GenExpr(unary)};
+    return;
+  }
+  addr_ = {IRBuilder().GenExpr(unary->operand_)};
+}
+
+
+void IRLValBuilder::VisitObject(Object* obj) {
+  if (obj->IsStatic()) {
+    addr_ = {IRValue::New(IROp::GLOBAL, IRType::PTR)};
+    addr_.ptr_->name_ = obj->Repr();
+    return;
+  }
+
+  // Compound literals are initialized where they are used first
+  if (obj->Anonymous() && obj->Decl() && !anonyDecls_.count(obj)) {
+    anonyDecls_.insert(obj);
+    IRBuilder().Visit(obj->Decl());
+  }
+  addr_ = {Slot(obj)};
+}
+
+
+// The identifier must be function
+void IRLValBuilder::VisitIdentifier(Identifier* ident) {
+  assert(!ident->ToTypeName());
+  addr_ = {IRValue::New(IROp::GLOBAL, IRType::PTR)};
+  addr_.ptr_->name_ = ident->Name();
+}
+
+
+void IRLValBuilder::VisitTempVar(TempVar* tempVar) {
+  addr_ = {Slot(tempVar, tempVar->Type()->Align())};
+}
@@ -0,0 +1,230 @@
+#ifndef _WGTCC_IR_H_
+#define _WGTCC_IR_H_
+
+#include "ast.h"
+#include "visitor.h"
+
+#include <cstdio>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+
+/*
+ * The mid-level IR: typed values in SSA form, organized in basic blocks.
+ * Locals live in 'alloca' slots accessed by explicit loads and stores,
+ * values merged by control flow are joined by phis.
+ * Aggregates are always handled by their address.
+ */
+
+enum class IRType {
+  VOID, I8, I16, I32, I64, F32, F64, PTR
+};
+
+
+enum class IROp {
+  // Values that are not in any block
+  CONST, FCONST, STRING, GLOBAL, PARAM,
+
+  // Memory
+  ALLOCA, LOAD, STORE, COPY, ZERO, PTRADD,
+
+  // Arithmetic
+  ADD, SUB, MUL, DIV, UDIV, REM, UREM,
+  AND, OR, XOR, SHL, SAR, SHR, NEG, NOT,
+
+  // Comparison, the result is 0 or 1
+  EQ, NE, LT, LE, GT, GE, ULT, ULE, UGT, UGE,
+
+  // Conversion
+  TRUNC, SEXT, ZEXT, FTOI, ITOF, FEXT, FTRUNC, BITCAST,
+
+  CALL, VASTART, VAARG, PHI,
+
+  // Terminators
+  BR, CONDBR, RET,
+};
+
+
+struct IRBlock;
+
+struct IRValue {
+  static IRValue* New(IROp op, IRType type);
+
+  bool IsInst() const { return op_ >= IROp::ALLOCA; }
+  bool IsTerminator() const { return op_ >= IROp::BR; }
+  bool IsCompare() const { return op_ >= IROp::EQ && op_ <= IROp::UGE; }
+
+  IROp op_;
+  IRType type_;
+  int id_ {-1};                   // Assigned when dumped
+  std::vector<IRValue*> operands_;
+  IRBlock* block_ {nullptr};
+
+  // PHI: the incoming blocks, parallel to operands_
+  // BR, CONDBR: the targets
+  std::vector<IRBlock*> blocks_;
+
+  long ival_ {0};                 // CONST; ALLOCA, COPY, ZERO, VAARG: size
+  double fval_ {0.0};
+  int align_ {0};                 // ALLOCA
+  std::string name_;              // GLOBAL, STRING; VAARG: class
+};
+
+
+struct IRBlock {
+  static IRBlock* New();
+
+  IRValue* Terminator() const {
+    return insts_.size() && insts_.back()->IsTerminator()
+        ? insts_.back(): nullptr;
+  }
+
+  int id_ {-1};
+  std::vector<IRValue*> insts_;
+  std::vector<IRBlock*> preds_;
+  std::vector<IRBlock*> succs_;
+
+  // Dominator tree, valid after IRFunc::ComputeDominators()
+  IRBlock* idom_ {nullptr};
+  int rpo_ {-1};
+};
+
+
+struct IRFunc {
+  static IRFunc* New(const std::string& name, IRType retType);
+
+  void ComputeCFG();
+  void RemoveUnreachable();
+  void ComputeDominators();
+  bool Dominates(IRBlock* dom, IRBlock* block) const;
+  std::set<IRValue*> PromotableSlots();
+  void Mem2Reg();
+  void Verify();
+  void Dump(FILE* fp);
+
+  std::string name_;
+  IRType retType_;
+  std::vector<IRValue*> params_;
+  // The first one is the entry block
+  std::vector<IRBlock*> blocks_;
+  // The slots of local objects
+  std::map<Object*, IRValue*> slots_;
+};
+
+using IRFuncList = std::vector<IRFunc*>;
+
+
+// The address of an lvalue, like ObjectAddr of the generator
+struct IRAddr {
+  IRValue* ptr_;
+  unsigned char bitFieldBegin_ {0};
+  unsigned char bitFieldWidth_ {0};
+};
+
+
+class IRBuilder: public Visitor {
+public:
+  IRBuilder() {}
+
+  virtual void Visit(ASTNode* node) { node->Accept(this); }
+  IRValue* GenExpr(Expr* expr) { expr->Accept(this); return val_; }
+
+  // Expression
+  virtual void VisitBinaryOp(BinaryOp* binaryOp);
+  virtual void VisitUnaryOp(UnaryOp* unaryOp);
+  virtual void VisitConditionalOp(ConditionalOp* condOp);
+  virtual void VisitFuncCall(FuncCall* funcCall);
+  virtual void VisitObject(Object* obj);
+  virtual void VisitEnumerator(Enumerator* enumer);
+  virtual void VisitIdentifier(Identifier* ident);
+  virtual void VisitConstant(Constant* cons);
+  virtual void VisitTempVar(TempVar* tempVar);
+
+  // Statement
+  virtual void VisitDeclaration(Declaration* init);
+  virtual void VisitEmptyStmt(EmptyStmt* emptyStmt) {}
+  virtual void VisitIfStmt(IfStmt* ifStmt);
+  virtual void VisitSwitchStmt(SwitchStmt* switchStmt);
+  virtual void VisitLoopStmt(LoopStmt* loopStmt);
+  virtual void VisitJumpStmt(JumpStmt* jumpStmt);
+  virtual void VisitReturnStmt(ReturnStmt* returnStmt);
+  virtual void VisitLabelStmt(LabelStmt* labelStmt);
+  virtual void VisitCompoundStmt(CompoundStmt* compoundStmt);
+
+  virtual void VisitFuncDef(FuncDef* funcDef);
+  virtual void VisitTranslationUnit(TranslationUnit* unit);
+
+  IRFuncList Build(TranslationUnit* unit);
+  IRFunc* Build(FuncDef* funcDef);
+
+protected:
+  void GenAssignOp(BinaryOp* assign);
+  void GenLogicalOp(BinaryOp* logicalOp);
+  void GenPointerArithm(BinaryOp* binary);
+  void GenIncDec(Expr* operand, bool postfix, IROp op);
+  void GenCastOp(UnaryOp* cast);
+  void GenBuiltin(FuncCall* funcCall);
+
+  IRValue* Emit(IROp op, IRType type,
+                const std::vector<IRValue*>& operands={});
+  IRValue* Const(IRType type, long val);
+  IRValue* Zero(IRType type);
+  IRValue* Coerce(IRValue* val, IRType type);
+  IRValue* Extend(IRValue* val, Type* type, IRType to);
+  IRValue* Cond(Expr* expr);
+  IRValue* Load(const IRAddr& addr, Type* type);
+  void Store(const IRAddr& addr, IRValue* val, Type* type);
+  IRValue* Slot(Object* obj);
+  IRValue* Slot(Expr* expr, int align);
+
+  IRBlock* LabelBlock(LabelStmt* label);
+  void Place(IRBlock* block);
+  void Br(IRBlock* block);
+  void CondBr(IRValue* cond, IRBlock* then, IRBlock* els);
+
+  static IRFunc* func_;
+  static IRBlock* cur_;
+  static int allocaEnd_;
+  static std::map<Expr*, IRValue*> slots_;
+  static std::map<LabelStmt*, IRBlock*> labels_;
+  static std::set<Object*> anonyDecls_;
+  static IRFuncList funcs_;
+
+  IRValue* val_ {nullptr};
+};
+
+
+class IRLValBuilder: public IRBuilder {
+public:
+  IRLValBuilder() {}
+
+  virtual void VisitBinaryOp(BinaryOp* binaryOp);
+  virtual void VisitUnaryOp(UnaryOp* unaryOp);
+  virtual void VisitObject(Object* obj);
+  virtual void VisitIdentifier(Identifier* ident);
+  virtual void VisitTempVar(TempVar* tempVar);
+
+  // Struct/union rvalues are already addresses
+  virtual void VisitConditionalOp(ConditionalOp* condOp) {
+    addr_ = {IRBuilder().GenExpr(condOp)};
+  }
+  virtual void VisitFuncCall(FuncCall* funcCall) {
+    addr_ = {IRBuilder().GenExpr(funcCall)};
+  }
+  virtual void VisitEnumerator(Enumerator* enumer) { assert(false); }
+  virtual void VisitConstant(Constant* cons) {
+    addr_ = {IRBuilder().GenExpr(cons)};
+  }
+
+  IRAddr GenAddr(Expr* expr) {
+    expr->Accept(this);
+    return addr_;
+  }
+
+private:
+  IRAddr addr_ {nullptr};
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include "code_gen.h"
 #include "cpp.h"
 #include "error.h"
+#include "ir.h"
 #include "parser.h"
 #include "scanner.h"
 
@@ -20,8 +21,12 @@ std::string program;
 std::string filename_in;
 std::string filename_out;
 bool debug = false;
+int optimize = 0;
+bool omit_frame_pointer = false;
 static bool only_preprocess = false;
 static bool only_compile = false;
+static bool only_emit_ir = false;
+static bool peephole_stats = false;
 static bool specified_out_name = false;
 static std::list<std::string> filenames_in;
 static std::list<std::string> gcc_filenames_in;
@@ -38,7 +43,13 @@ static void Usage() {
        "  -I        Add search path\n"
        "  -E        Preprocess only; do not compile, assemble or link\n"
        "  -S        Compile only; do not assemble or link\n"
-       "  -o        specify output file\n");
+       "  -o        specify output file\n"
+       "  -O1       Enable optimizations\n"
+       "  -fomit-frame-pointer\n"
+       "            Address the frame by %%rsp and allocate %%rbp, with -O1\n"
+       "  -emit-ir  Dump the verified IR; do not generate assembly\n"
+       "  -peephole-stats\n"
+       "            Print how many times each peephole rule fired\n");
 
   exit(0);
 }
@@ -100,17 +111,29 @@ static int RunWgtcc() {
     return 0;
   }
 
+  Parser parser(ts);
+  parser.Parse();
+  if (only_emit_ir) {
+    for (auto func: IRBuilder().Build(parser.Unit())) {
+      if (optimize)
+        func->Mem2Reg();
+      func->Verify();
+      func->Dump(fp);
+    }
+    return 0;
+  }
+
   if (!only_compile || !specified_out_name) {
     filename_out = GetName(filename_in);
     filename_out.back() = 's';
   }
   fp = fopen(filename_out.c_str(), "w");
 
-  Parser parser(ts);
-  parser.Parse();
   Generator::SetInOut(&parser, fp);
   Generator().Gen();
   fclose(fp);
+  if (peephole_stats)
+    Generator::DumpPeepholeStats(stderr);
   return 0;
 }
 
@@ -201,6 +224,25 @@ int main(int argc, char* argv[]) {
       specified_out_name = true;
       ParseOut(argc, argv, i); break;
     case 'g': gcc_args.pop_back(); debug = true; break;
+    case 'e':
+      if (std::string(argv[i]) == "-emit-ir") {
+        gcc_args.pop_back();
+        only_emit_ir = true;
+      }
+      break;
+    case 'p':
+      if (std::string(argv[i]) == "-peephole-stats") {
+        gcc_args.pop_back();
+        peephole_stats = true;
+      }
+      break;
+    case 'f':
+      if (std::string(argv[i]) == "-fomit-frame-pointer") {
+        gcc_args.pop_back();
+        omit_frame_pointer = true;
+      }
+      break;
+    case 'O': optimize = argv[i][2] ? atoi(&argv[i][2]): 1; break;
     default:;
     }
   }
@@ -230,7 +272,7 @@ int main(int argc, char* argv[]) {
   }
 #endif
 
-  if (only_preprocess || only_compile) {
+  if (only_preprocess || only_compile || only_emit_ir) {
     if (specified_out_name && filenames_in.size() > 1)
       Error("cannot specifier output filename with multiple input file");
     return 0;
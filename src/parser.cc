@@ -17,12 +17,6 @@ FuncType* Parser::vaStartType_ {nullptr};
 FuncType* Parser::vaArgType_ {nullptr};
 
 
-FuncDef* Parser::EnterFunc(Identifier* ident) {
-  curFunc_ = FuncDef::New(ident, LabelStmt::New());
-  return curFunc_;
-}
-
-
 void Parser::ExitFunc() {
   // Resolve 那些待定的jump；
   // 如果有jump无法resolve，也就是有未定义的label，报错；
@@ -47,6 +41,7 @@ void Parser::ExitFunc() {
 
 void Parser::EnterBlock(FuncType* funcType) {
   curScope_ = new Scope(curScope_, S_BLOCK);
+  curScope_->Enter();
   if (funcType) {
     // Merge elements in param scope into current block scope
     for (auto param: funcType->Params())
@@ -58,6 +53,7 @@ void Parser::EnterBlock(FuncType* funcType) {
 void Parser::Parse() {
   DefineBuiltins();
   ParseTranslationUnit();
+  ParseLazyFuncDefs();
 }
 
 
@@ -91,13 +87,14 @@ void Parser::ParseTranslationUnit() {
       if (decl) unit_->Add(decl);
 
       while (ts_.Try(',')) {
-        auto ident = ParseDirectDeclarator(declType, storageSpec,
-                                           funcSpec, align);
+        ident = ParseDirectDeclarator(declType, storageSpec, funcSpec, align);
         decl = ParseInitDeclarator(ident);
         if (decl) unit_->Add(decl);
       }
       // GNU extension: function/type/variable attributes
-      TryAttributeSpecList();
+      auto spec = TryAttributeSpecList();
+      if (spec && ident->Type()->ToFunc())
+        ident->Type()->ToFunc()->AddFuncSpec(spec);
       ts_.Expect(';');
     }
   }
@@ -105,7 +102,7 @@ void Parser::ParseTranslationUnit() {
 
 
 FuncDef* Parser::ParseFuncDef(Identifier* ident) {
-  auto funcDef = EnterFunc(ident);
+  auto funcDef = FuncDef::New(ident, LabelStmt::New());
 
   if (funcDef->FuncType()->Complete()) {
     Error(ident, "redefinition of '%s'", funcDef->Name().c_str());
@@ -118,13 +115,88 @@ FuncDef* Parser::ParseFuncDef(Identifier* ident) {
     if (param->Anonymous())
       Error(param, "param name omitted");
   }
-  funcDef->SetBody(ParseCompoundStmt(funcType));
-  ExitFunc();
 
+  if (ident->Linkage() != L_INTERNAL || usedFuncs_.count(ident->Name())) {
+    ParseFuncBody(funcDef);
+    return funcDef;
+  }
+
+  // Record where the body begins and skip to the matching '}'.
+  // '__func__' is substituted while peeking, so it needs curFunc_.
+  lazyFuncs_[ident->Name()] = {funcDef, ts_, Scope::LastSeq()};
+  EnterFunc(funcDef);
+  for (int depth = 1; depth > 0;) {
+    auto tok = ts_.Next();
+    if (tok->IsEOF())
+      Error(tok, "premature end of input");
+    else if (tok->tag_ == '{')
+      ++depth;
+    else if (tok->tag_ == '}')
+      --depth;
+  }
+  ExitFunc();
   return funcDef;
 }
 
 
+void Parser::ParseFuncBody(FuncDef* funcDef) {
+  EnterFunc(funcDef);
+  funcDef->SetBody(ParseCompoundStmt(funcDef->FuncType()));
+  ExitFunc();
+}
+
+
+// Parse bodies of the used static functions, which may use more of them.
+// Those never used are removed from the translation unit.
+void Parser::ParseLazyFuncDefs() {
+  auto ts = ts_;
+  while (!pendingFuncs_.empty()) {
+    const auto& lazy = lazyFuncs_[pendingFuncs_.back()];
+    pendingFuncs_.pop_back();
+    if (lazy.funcDef_->Body() == nullptr)
+      ParseLazyFuncBody(lazy);
+  }
+  ts_ = ts;
+
+  std::set<ExtDecl*> unused;
+  for (auto& kv: lazyFuncs_) {
+    if (!usedFuncs_.count(kv.first))
+      unused.insert(kv.second.funcDef_);
+  }
+  unit_->ExtDecls().remove_if([&unused](ExtDecl* extDecl) {
+    return unused.count(extDecl) > 0;
+  });
+}
+
+
+// Names declared after the body are not visible to it
+void Parser::ParseLazyFuncBody(const LazyFunc& lazy) {
+  ts_ = lazy.ts_;
+  Scope::SetHorizon(lazy.horizon_);
+  ParseFuncBody(lazy.funcDef_);
+  Scope::SetHorizon(INT_MAX);
+}
+
+
+// A file scope type is about to be completed. The bodies skipped so far
+// are parsed now, so that they still see it incomplete.
+void Parser::ParseSkippedFuncBodies() {
+  auto ts = ts_;
+  for (const auto& kv: lazyFuncs_) {
+    if (kv.second.funcDef_->Body() == nullptr)
+      ParseLazyFuncBody(kv.second);
+  }
+  ts_ = ts;
+}
+
+
+void Parser::MarkUsed(Identifier* ident) {
+  const auto& name = ident->Name();
+  if (usedFuncs_.insert(name).second && lazyFuncs_.count(name))
+    pendingFuncs_.push_back(name);
+}
+
+
 Expr* Parser::ParseExpr() {
   return ParseCommaExpr();
 }
@@ -157,6 +229,8 @@ Expr* Parser::ParsePrimaryExpr() {
 
   if (tok->IsIdentifier()) {
     auto ident = curScope_->Find(tok);
+    if (ident && ident->Linkage() == L_INTERNAL && ident->Type()->ToFunc())
+      MarkUsed(ident);
     if (ident) return ident;
     if (IsBuiltin(tok->str_)) return GetBuiltin(tok);
     Error(tok, "undefined symbol '%s'", tok->str_.c_str());
@@ -582,154 +656,68 @@ Expr* Parser::ParseCastExpr() {
 }
 
 
-Expr* Parser::ParseMultiplicativeExpr() {
-  auto lhs = ParseCastExpr();
-  auto tok = ts_.Next();
-  while (tok->tag_ == '*' || tok->tag_ == '/' || tok->tag_ == '%') {
-    auto rhs = ParseCastExpr();
-    lhs = BinaryOp::New(tok, lhs, rhs);
-
-    tok = ts_.Next();
-  }
-
-  ts_.PutBack();
-  return lhs;
-}
-
-
-Expr* Parser::ParseAdditiveExpr() {
-  auto lhs = ParseMultiplicativeExpr();
-  auto tok = ts_.Next();
-  while (tok->tag_ == '+' || tok->tag_ == '-') {
-    auto rhs = ParseMultiplicativeExpr();
-    lhs = BinaryOp::New(tok, lhs, rhs);
-
-    tok = ts_.Next();
-  }
-
-  ts_.PutBack();
-  return lhs;
-}
-
-
-Expr* Parser::ParseShiftExpr() {
-  auto lhs = ParseAdditiveExpr();
-  auto tok = ts_.Next();
-  while (tok->tag_ == Token::LEFT || tok->tag_ == Token::RIGHT) {
-    auto rhs = ParseAdditiveExpr();
-    lhs = BinaryOp::New(tok, lhs, rhs);
-
-    tok = ts_.Next();
-  }
-
-  ts_.PutBack();
-  return lhs;
-}
-
-
-Expr* Parser::ParseRelationalExpr() {
-  auto lhs = ParseShiftExpr();
-  auto tok = ts_.Next();
-  while (tok->tag_ == Token::LE || tok->tag_ == Token::GE
-      || tok->tag_ == '<' || tok->tag_ == '>') {
-    auto rhs = ParseShiftExpr();
-    lhs = BinaryOp::New(tok, lhs, rhs);
-
-    tok = ts_.Next();
-  }
-
-  ts_.PutBack();
-  return lhs;
-}
-
-
-Expr* Parser::ParseEqualityExpr() {
-  auto lhs = ParseRelationalExpr();
-  auto tok = ts_.Next();
-  while (tok->tag_ == Token::EQ || tok->tag_ == Token::NE) {
-    auto rhs = ParseRelationalExpr();
-    lhs = BinaryOp::New(tok, lhs, rhs);
-
-    tok = ts_.Next();
-  }
-
-  ts_.PutBack();
-  return lhs;
-}
-
-
-Expr* Parser::ParseBitiwiseAndExpr() {
-  auto lhs = ParseEqualityExpr();
-  auto tok = ts_.Peek();
-  while (ts_.Try('&')) {
-    auto rhs = ParseEqualityExpr();
-    lhs = BinaryOp::New(tok, lhs, rhs);
-
-    tok = ts_.Peek();
-  }
-
-  return lhs;
-}
-
-
-Expr* Parser::ParseBitwiseXorExpr() {
-  auto lhs = ParseBitiwiseAndExpr();
-  auto tok = ts_.Peek();
-  while (ts_.Try('^')) {
-    auto rhs = ParseBitiwiseAndExpr();
-    lhs = BinaryOp::New(tok, lhs, rhs);
-
-    tok = ts_.Peek();
-  }
-
-  return lhs;
-}
-
-
-Expr* Parser::ParseBitwiseOrExpr() {
-  auto lhs = ParseBitwiseXorExpr();
-  auto tok = ts_.Peek();
-  while (ts_.Try('|')) {
-    auto rhs = ParseBitwiseXorExpr();
-    lhs = BinaryOp::New(tok, lhs, rhs);
-
-    tok = ts_.Peek();
+/*
+ * Binding power of binary operators, from '||' up to multiplicative ones.
+ * Returns 0 if the token is not a binary operator (',', '?' and the
+ * assignment operators are handled by their own parse functions).
+ */
+static int BindingPower(int tag) {
+  switch (tag) {
+  case Token::LOGICAL_OR:  return 1;
+  case Token::LOGICAL_AND: return 2;
+  case '|':                return 3;
+  case '^':                return 4;
+  case '&':                return 5;
+  case Token::EQ:
+  case Token::NE:          return 6;
+  case '<':
+  case '>':
+  case Token::LE:
+  case Token::GE:          return 7;
+  case Token::LEFT:
+  case Token::RIGHT:       return 8;
+  case '+':
+  case '-':                return 9;
+  case '*':
+  case '/':
+  case '%':                return 10;
+  default:                 return 0;
   }
-
-  return lhs;
 }
 
 
-Expr* Parser::ParseLogicalAndExpr() {
-  auto lhs = ParseBitwiseOrExpr();
-  auto tok = ts_.Peek();
-  while (ts_.Try(Token::LOGICAL_AND)) {
-    auto rhs = ParseBitwiseOrExpr();
-    lhs = BinaryOp::New(tok, lhs, rhs);
-
-    tok = ts_.Peek();
+/*
+ * Operator precedence parsing of all left associative binary operators.
+ * Operators waiting on the stack have strictly increasing binding power,
+ * so the stacks never grow deeper than the number of levels.
+ * Operands are reduced in the same order as with recursive descent.
+ */
+Expr* Parser::ParseBinaryExpr() {
+  static const int kLevels = 10;
+  Expr* operands[kLevels + 1];
+  const Token* ops[kLevels];
+  int top = 0;
+
+  operands[0] = ParseCastExpr();
+  for (int power; (power = BindingPower(ts_.Peek()->tag_)); ) {
+    auto tok = ts_.Next();
+    for (; top > 0 && BindingPower(ops[top - 1]->tag_) >= power; --top) {
+      operands[top - 1] = BinaryOp::New(ops[top - 1],
+                                        operands[top - 1], operands[top]);
+    }
+    ops[top] = tok;
+    operands[++top] = ParseCastExpr();
   }
-
-  return lhs;
-}
-
-
-Expr* Parser::ParseLogicalOrExpr() {
-  auto lhs = ParseLogicalAndExpr();
-  auto tok = ts_.Peek();
-  while (ts_.Try(Token::LOGICAL_OR)) {
-    auto rhs = ParseLogicalAndExpr();
-    lhs = BinaryOp::New(tok, lhs, rhs);
-
-    tok = ts_.Peek();
+  for (; top > 0; --top) {
+    operands[top - 1] = BinaryOp::New(ops[top - 1],
+                                      operands[top - 1], operands[top]);
   }
-
-  return lhs;
+  return operands[0];
 }
 
 
 Expr* Parser::ParseConditionalExpr() {
-  auto cond = ParseLogicalOrExpr();
+  auto cond = ParseBinaryExpr();
   auto tok = ts_.Peek();
   if (ts_.Try('?')) {
     // Non-standard GNU extension
@@ -925,6 +913,15 @@ QualType Parser::ParseDeclSpec(int* storageSpec, int* funcSpec, int* alignSpec)
       *funcSpec |= F_NORETURN;
       break;
 
+    // GNU extension: function attributes
+    case Token::ATTRIBUTE: {
+      ts_.PutBack();
+      auto spec = TryAttributeSpecList();
+      if (funcSpec)
+        *funcSpec |= spec;
+      break;
+    }
+
     // Alignment specifier
     case Token::ALIGNAS: {
       if (!alignSpec)
@@ -1228,6 +1225,8 @@ Type* Parser::ParseStructUnionSpec(bool isStruct) {
       //   因为编译器总是向上查找符号，不管找到的是完整的还是不完整的，都要；
       if (!tagIdent->Type()->Complete()) {
         // 找到了此tag的前向声明，并更新其符号表，最后设置为complete type
+        if (curScope_->Type() == S_FILE)
+          ParseSkippedFuncBodies();
         return ParseStructUnionDecl(tagIdent->Type()->ToStruct());
       } else {
         // 在当前作用域找到了完整的定义，并且现在正在定义同名的类型，所以报错；
@@ -1278,6 +1277,7 @@ StructType* Parser::ParseStructUnionDecl(StructType* type) {
 
   auto scopeBackup = curScope_;
   curScope_ = type->MemberMap(); // Internal symbol lookup rely on curScope_
+  curScope_->Enter();
   while (!ts_.Try('}')) {
     if (ts_.Empty()) {
       Error(ts_.Peek(), "premature end of input");
@@ -1319,7 +1319,7 @@ StructType* Parser::ParseStructUnionDecl(StructType* type) {
         // C11 6.7.2.1 [3]:
         if (type->IsStruct() &&
             // Struct has more than one named member
-            type->MemberMap()->size() > 0 &&
+            type->Fields().size() > 0 &&
             memberType->ToArray()) {
           ts_.Expect(';'); ts_.Expect('}');
           ADD_MEMBER();
@@ -1349,6 +1349,7 @@ finalize:
       Error(tag, "redefinition of tag '%s'\n", tag->Name().c_str());
     scopeBackup->InsertTag(tag);
   }
+  curScope_->Exit();
   curScope_ = scopeBackup;
 
   return type;
@@ -1442,14 +1443,23 @@ QualType Parser::ParsePointer(QualType typePointedTo) {
 }
 
 
+// Pointer and array types are shared, so the derivation chain is
+// rebuilt instead of being modified in place.
 static QualType ModifyBase(QualType type, QualType base, QualType newBase) {
   if (type == base)
     return newBase;
 
   auto ty = type->ToDerived();
-  ty->SetDerived(ModifyBase(ty->Derived(), base, newBase));
-
-  return ty;
+  auto derived = ModifyBase(ty->Derived(), base, newBase);
+  if (type->ToPointer()) {
+    return QualType(PointerType::New(derived), type.Qual());
+  } else if (type->ToArray()) {
+    auto len = type->Complete() ? type->ToArray()->Len(): -1;
+    return QualType(ArrayType::New(len, derived), type.Qual());
+  }
+  // The function type is created by this declarator, it is not shared
+  ty->SetDerived(derived);
+  return QualType(ty, type.Qual());
 }
 
 
@@ -1503,6 +1513,9 @@ Identifier* Parser::ProcessDeclarator(const Token* tok,
   const auto& name = tok->str_;
   Identifier* ident;
 
+  if (funcSpec && type->ToFunc())
+    type->ToFunc()->AddFuncSpec(funcSpec);
+
   if (storageSpec & S_TYPEDEF) {
     // C11 6.7.5 [2]: alignment specifier
     if (align > 0)
@@ -1569,11 +1582,19 @@ Identifier* Parser::ProcessDeclarator(const Token* tok,
       }
     }
     // The same declaration, simply return the prio declaration
-    if (!ident->Type()->Complete())
+    auto defined = ident->Type()->ToFunc() && ident->Type()->Complete();
+    if (!ident->Type()->Complete()) {
+      if (curScope_->Type() == S_FILE)
+        ParseSkippedFuncBodies();
       ident->Type()->SetComplete(type->Complete());
-    // Prio declaration of a function may omit the param name
-    if (type->ToFunc())
-      ident->Type()->ToFunc()->SetParams(type->ToFunc()->Params());
+    }
+    // Prio declaration of a function may omit the param name,
+    // the body of a definition keeps using its own params
+    if (type->ToFunc()) {
+      if (!defined)
+        ident->Type()->ToFunc()->SetParams(type->ToFunc()->Params());
+      ident->Type()->ToFunc()->AddFuncSpec(funcSpec);
+    }
     else if (ident->ToObject() && !(storageSpec & S_EXTERN))
       ident->ToObject()->SetStorage(ident->ToObject()->Storage() & ~S_EXTERN);
     return ident;
@@ -1819,10 +1840,12 @@ Declaration* Parser::ParseInitDeclaratorSub(Object* obj) {
   // the order of the initialization.
   if (obj->Decl()) {
     ParseInitializer(obj->Decl(), obj->Type(), 0, false, true);
+    obj->Decl()->FinishInits();
     return nullptr;
   } else {
     auto decl = Declaration::New(obj);
     ParseInitializer(decl, obj->Type(), 0, false, true);
+    decl->FinishInits();
     obj->SetDecl(decl);
     return decl;
   }
@@ -1987,7 +2010,14 @@ void Parser::ParseArrayInitializer(Declaration* decl,
     ++idx;
 
     if (type->Complete() && idx >= type->Len()) {
-      break;
+      // Designators may still follow the last element
+      if (!ts_.Try(','))
+        break;
+      if (!ts_.Test('[') && (hasBrace || !ts_.Test('.'))) {
+        ts_.PutBack();
+        break;
+      }
+      continue;
     } else if (!type->Complete()) {
       type->SetLen(std::max(idx, type->Len()));
     }
@@ -2011,20 +2041,10 @@ void Parser::ParseArrayInitializer(Declaration* decl,
 
 StructType::Iterator Parser::ParseStructDesignator(StructType* type,
                                                    const std::string& name) {
-  auto iter = type->Members().begin();
-  for (; iter != type->Members().end(); ++iter) {
-    if ((*iter)->Anonymous()) {
-      auto anonyType = (*iter)->Type()->ToStruct();
-      assert(anonyType);
-      if (anonyType->GetMember(name)) {
-        return iter; // ParseStructDesignator(anonyType);
-      }
-    } else if ((*iter)->Name() == name) {
-      return iter;
-    }
-  }
-  assert(false);
-  return iter;
+  // Members of anonymous struct/union designate the enclosing member
+  auto field = type->GetField(name);
+  assert(field);
+  return type->Members().begin() + field->index_;
 }
 
 
@@ -2247,15 +2267,8 @@ CompoundStmt* Parser::ParseForStmt() {
     ts_.Expect(')');
   }
 
-  auto condLabel = LabelStmt::New();
   auto stepLabel = LabelStmt::New();
   auto endLabel = LabelStmt::New();
-  stmts.push_back(condLabel);
-  if (condExpr) {
-    auto gotoEndStmt = JumpStmt::New(endLabel);
-    auto ifStmt = IfStmt::New(condExpr, EmptyStmt::New(), gotoEndStmt);
-    stmts.push_back(ifStmt);
-  }
 
   // 我们需要给break和continue语句提供相应的标号，不然不知往哪里跳
   Stmt* bodyStmt;
@@ -2264,14 +2277,8 @@ CompoundStmt* Parser::ParseForStmt() {
   // 因为for的嵌套结构，在这里需要回复break和continue的目标标号
   EXIT_LOOP_BODY()
 
-  stmts.push_back(bodyStmt);
-  stmts.push_back(stepLabel);
-  if (stepExpr)
-    stmts.push_back(stepExpr);
-  else
-    stmts.push_back(EmptyStmt::New());
-  stmts.push_back(JumpStmt::New(condLabel));
-  stmts.push_back(endLabel);
+  stmts.push_back(LoopStmt::New(condExpr, bodyStmt, stepExpr,
+                                stepLabel, endLabel));
 
   auto scope = curScope_;
   ExitBlock();
@@ -2284,14 +2291,13 @@ CompoundStmt* Parser::ParseForStmt() {
  * while 循环结构：
  * while (expression) statement
  * 展开后的结构：
- * cond: if (expression) then empty
+ *      if (expression) then empty
  *		else goto end
- *		statement
- *		goto cond
+ * begin: statement
+ * cond: if (expression) then goto begin
  * end:
  */
-CompoundStmt* Parser::ParseWhileStmt() {
-  std::list<Stmt*> stmts;
+LoopStmt* Parser::ParseWhileStmt() {
   ts_.Expect('(');
   auto tok = ts_.Peek();
   auto condExpr = ParseExpr();
@@ -2303,21 +2309,13 @@ CompoundStmt* Parser::ParseWhileStmt() {
 
   auto condLabel = LabelStmt::New();
   auto endLabel = LabelStmt::New();
-  auto gotoEndStmt = JumpStmt::New(endLabel);
-  auto ifStmt = IfStmt::New(condExpr, EmptyStmt::New(), gotoEndStmt);
-  stmts.push_back(condLabel);
-  stmts.push_back(ifStmt);
 
   Stmt* bodyStmt;
   ENTER_LOOP_BODY(endLabel, condLabel)
   bodyStmt = ParseStmt();
   EXIT_LOOP_BODY()
 
-  stmts.push_back(bodyStmt);
-  stmts.push_back(JumpStmt::New(condLabel));
-  stmts.push_back(endLabel);
-
-  return CompoundStmt::New(stmts);
+  return LoopStmt::New(condExpr, bodyStmt, nullptr, condLabel, endLabel);
 }
 
 
@@ -2330,34 +2328,28 @@ CompoundStmt* Parser::ParseWhileStmt() {
  *		 else goto end
  * end:
  */
-CompoundStmt* Parser::ParseDoStmt() {
-  auto beginLabel = LabelStmt::New();
+LoopStmt* Parser::ParseDoStmt() {
   auto condLabel = LabelStmt::New();
   auto endLabel = LabelStmt::New();
 
   Stmt* bodyStmt;
-  ENTER_LOOP_BODY(endLabel, beginLabel)
+  ENTER_LOOP_BODY(endLabel, condLabel)
   bodyStmt = ParseStmt();
   EXIT_LOOP_BODY()
 
   ts_.Expect(Token::WHILE);
   ts_.Expect('(');
+  auto tok = ts_.Peek();
   auto condExpr = ParseExpr();
   ts_.Expect(')');
   ts_.Expect(';');
 
-  auto gotoBeginStmt = JumpStmt::New(beginLabel);
-  auto gotoEndStmt = JumpStmt::New(endLabel);
-  auto ifStmt = IfStmt::New(condExpr, gotoBeginStmt, gotoEndStmt);
-
-  std::list<Stmt*> stmts;
-  stmts.push_back(beginLabel);
-  stmts.push_back(bodyStmt);
-  stmts.push_back(condLabel);
-  stmts.push_back(ifStmt);
-  stmts.push_back(endLabel);
+  if (!condExpr->Type()->IsScalar()) {
+    Error(tok, "scalar expression expected");
+  }
 
-  return CompoundStmt::New(stmts);
+  return LoopStmt::New(condExpr, bodyStmt, nullptr,
+                       condLabel, endLabel, true);
 }
 
 
@@ -2383,10 +2375,10 @@ CompoundStmt* Parser::ParseDoStmt() {
 
 /*
  * switch
- *  jump stmt (skip case labels)
+ *  dispatch (jump to the case labels, or default/end)
  *  case labels
  *  jump stmts
- *  default jump stmt
+ * end:
  */
 CompoundStmt* Parser::ParseSwitchStmt() {
   std::list<Stmt*> stmts;
@@ -2398,31 +2390,32 @@ CompoundStmt* Parser::ParseSwitchStmt() {
   if (!expr->Type()->IsInteger()) {
     Error(tok, "switch quantity not an integer");
   }
+  auto type = ArithmType::IntegerPromote(expr->Type()->ToArithm());
+  expr = Expr::MayCast(expr, type);
 
-  auto testLabel = LabelStmt::New();
   auto endLabel = LabelStmt::New();
-  auto t = TempVar::New(expr->Type());
-  auto assign = BinaryOp::New(tok, '=', t, expr);
-  stmts.push_back(assign);
-  stmts.push_back(JumpStmt::New(testLabel));
+  auto switchStmt = SwitchStmt::New(expr);
+  stmts.push_back(switchStmt);
 
   CaseLabelList caseLabels;
   ENTER_SWITCH_BODY(endLabel, caseLabels);
 
   auto bodyStmt = ParseStmt(); // Fill caseLabels and defaultLabel
   stmts.push_back(bodyStmt);
-  stmts.push_back(JumpStmt::New(endLabel));
-  stmts.push_back(testLabel);
-
-  for (auto iter = caseLabels.begin();
-       iter != caseLabels.end(); ++iter) {
-    auto cond = BinaryOp::New(tok, Token::EQ, t, iter->first);
-    auto then = JumpStmt::New(iter->second);
-    auto ifStmt = IfStmt::New(cond, then, nullptr);
-    stmts.push_back(ifStmt);
-  }
-  if (defaultLabel_)
-    stmts.push_back(JumpStmt::New(defaultLabel_));
+
+  // Case values are converted to the promoted type of the expression
+  std::set<long> vals;
+  for (const auto& caseLabel: caseLabels) {
+    auto val = caseLabel.first->IVal();
+    if (type->Width() == 4 && type->IsUnsigned())
+      val = static_cast<unsigned>(val);
+    else if (type->Width() == 4)
+      val = static_cast<int>(val);
+    if (!vals.insert(val).second)
+      Error(caseLabel.first, "duplicate case value");
+    switchStmt->AddCase(val, caseLabel.second);
+  }
+  switchStmt->SetDefault(defaultLabel_ ? defaultLabel_: endLabel);
   EXIT_SWITCH_BODY();
 
   stmts.push_back(endLabel);
@@ -2602,38 +2595,52 @@ Identifier* Parser::GetBuiltin(const Token* tok) {
  */
 
 // Attribute
-void Parser::TryAttributeSpecList() {
+// Returns the function specifiers given by the attributes,
+// the other attributes are ignored
+int Parser::TryAttributeSpecList() {
+  int funcSpec = 0;
   while (ts_.Try(Token::ATTRIBUTE))
-    ParseAttributeSpec();
+    funcSpec |= ParseAttributeSpec();
+  return funcSpec;
 }
 
 
-void Parser::ParseAttributeSpec() {
+int Parser::ParseAttributeSpec() {
   ts_.Expect('(');
   ts_.Expect('(');
 
+  int funcSpec = 0;
   while (!ts_.Try(')')) {
-    ParseAttribute();
+    funcSpec |= ParseAttribute();
     if (!ts_.Try(',')) {
       ts_.Expect(')');
       break;
     }
   }
   ts_.Expect(')');
+  return funcSpec;
 }
 
 
-void Parser::ParseAttribute() {
-  if (!ts_.Test(Token::IDENTIFIER))
-    return;
+int Parser::ParseAttribute() {
+  auto tok = ts_.Peek();
+  if (!tok->IsIdentifier() && !tok->IsKeyWord())
+    return 0;
+  ts_.Next();
+  // Skip the arguments
   if (ts_.Try('(')) {
-    if (ts_.Try(')'))
-      return;
-
-    ts_.Expect(Token::IDENTIFIER);
-    if (ts_.Test(',')) {
-      while (ts_.Try(',')) {}
+    for (int depth = 1; depth > 0;) {
+      auto tok = ts_.Next();
+      if (tok->IsEOF())
+        Error(tok, "premature end of input");
+      depth += tok->tag_ == '(' ? 1: tok->tag_ == ')' ? -1: 0;
     }
-    ts_.Try(')');
   }
+
+  const auto& name = tok->str_;
+  if (name == "always_inline" || name == "__always_inline__")
+    return F_ALWAYS_INLINE;
+  if (name == "noinline" || name == "__noinline__")
+    return F_NOINLINE;
+  return 0;
 }
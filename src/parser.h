@@ -9,7 +9,9 @@
 #include "token.h"
 
 #include <cassert>
+#include <map>
 #include <memory>
+#include <set>
 #include <stack>
 
 
@@ -22,7 +24,15 @@ class Parser {
   using CaseLabelList = std::vector<std::pair<Constant*, LabelStmt*>>;
   using LabelJumpList = std::list<std::pair<const Token*, JumpStmt*>>;
   using LabelMap = std::map<std::string, LabelStmt*>;
+  // A function body skipped, and what was declared before it
+  struct LazyFunc {
+    FuncDef* funcDef_;
+    TokenSequence ts_;
+    int horizon_;
+  };
+  using LazyFuncMap = std::map<std::string, LazyFunc>;
   friend class Generator;
+  friend class IRBuilder;
 
 public:
   explicit Parser(const TokenSequence& ts)
@@ -37,6 +47,7 @@ public:
       caseLabels_(nullptr),
       defaultLabel_(nullptr) {
         ts_.SetParser(this);
+        curScope_->Enter();
       }
 
   ~Parser() {}
@@ -52,6 +63,11 @@ public:
   void Parse();
   void ParseTranslationUnit();
   FuncDef* ParseFuncDef(Identifier* ident);
+  void ParseFuncBody(FuncDef* funcDef);
+  void ParseLazyFuncDefs();
+  void ParseLazyFuncBody(const LazyFunc& lazy);
+  void ParseSkippedFuncBodies();
+  void MarkUsed(Identifier* ident);
 
 
   // Expressions
@@ -74,16 +90,7 @@ public:
 
   QualType ParseTypeName();
   Expr* ParseCastExpr();
-  Expr* ParseMultiplicativeExpr();
-  Expr* ParseAdditiveExpr();
-  Expr* ParseShiftExpr();
-  Expr* ParseRelationalExpr();
-  Expr* ParseEqualityExpr();
-  Expr* ParseBitiwiseAndExpr();
-  Expr* ParseBitwiseXorExpr();
-  Expr* ParseBitwiseOrExpr();
-  Expr* ParseLogicalAndExpr();
-  Expr* ParseLogicalOrExpr();
+  Expr* ParseBinaryExpr();
   Expr* ParseConditionalExpr();
   Expr* ParseCommaExpr();
   Expr* ParseAssignExpr();
@@ -141,8 +148,8 @@ public:
   CompoundStmt* ParseCompoundStmt(FuncType* funcType=nullptr);
   IfStmt* ParseIfStmt();
   CompoundStmt* ParseSwitchStmt();
-  CompoundStmt* ParseWhileStmt();
-  CompoundStmt* ParseDoStmt();
+  LoopStmt* ParseWhileStmt();
+  LoopStmt* ParseDoStmt();
   CompoundStmt* ParseForStmt();
   JumpStmt* ParseGotoStmt();
   JumpStmt* ParseContinueStmt();
@@ -157,9 +164,9 @@ public:
                                 int funcSpec,
                                 int align);
   // GNU extensions
-  void TryAttributeSpecList();
-  void ParseAttributeSpec();
-  void ParseAttribute();
+  int TryAttributeSpecList();
+  int ParseAttributeSpec();
+  int ParseAttribute();
   bool IsTypeName(const Token* tok) const{
     if (tok->IsTypeSpecQual())
       return true;
@@ -189,10 +196,13 @@ public:
   }
 
   void EnterBlock(FuncType* funcType=nullptr);
-  void ExitBlock() { curScope_ = curScope_->Parent(); }
-  void EnterProto() { curScope_ = new Scope(curScope_, S_PROTO); }
-  void ExitProto() { curScope_ = curScope_->Parent(); }
-  FuncDef* EnterFunc(Identifier* ident);
+  void ExitBlock() { curScope_->Exit(); curScope_ = curScope_->Parent(); }
+  void EnterProto() {
+    curScope_ = new Scope(curScope_, S_PROTO);
+    curScope_->Enter();
+  }
+  void ExitProto() { curScope_->Exit(); curScope_ = curScope_->Parent(); }
+  void EnterFunc(FuncDef* funcDef) { curFunc_ = funcDef; }
   void ExitFunc();
 
   LabelStmt* FindLabel(const std::string& label) {
@@ -237,6 +247,12 @@ private:
   LabelStmt* continueDest_;
   CaseLabelList* caseLabels_;
   LabelStmt* defaultLabel_;
+
+  // Bodies of static functions are skipped until the function is used.
+  // Functions never used are dropped from the translation unit.
+  std::set<std::string> usedFuncs_;
+  LazyFuncMap lazyFuncs_;
+  std::vector<std::string> pendingFuncs_;
 };
 
 #endif
@@ -3,32 +3,130 @@
 #include "ast.h"
 
 #include <cassert>
+#include <climits>
 #include <iostream>
+#include <unordered_map>
+
+
+int Scope::seq_ = 0;
+int Scope::horizon_ = INT_MAX;
+
+
+Symbol* Symbol::Intern(const std::string& name) {
+  // Pointers to elements of an unordered_map stay valid after rehashing
+  static std::unordered_map<std::string, Symbol> symbols;
+  return &symbols[name];
+}
+
+
+Symbol* Symbol::Intern(const Token* tok) {
+  if (tok->sym_ == nullptr)
+    tok->sym_ = Intern(tok->str_);
+  return tok->sym_;
+}
+
+
+void Scope::Exit() {
+  // Bindings are popped in the reverse order they were pushed.
+  // Usually they are at the back of the stack, except for tags
+  // exported to the enclosing scope from a struct/union scope.
+  for (auto iter = pushed_.rbegin(); iter != pushed_.rend(); ++iter) {
+    auto& stack = **iter;
+    for (auto b = stack.end(); b != stack.begin();) {
+      if ((--b)->scope_ == this) {
+        stack.erase(b);
+        break;
+      }
+    }
+  }
+  pushed_.clear();
+  active_ = false;
+}
+
+
+Identifier* Scope::Lookup(const Symbol::BindingStack& stack, bool curScope) {
+  assert(active_);
+  // Skip bindings of inner scopes when searching from an enclosing scope
+  for (auto iter = stack.rbegin(); iter != stack.rend(); ++iter) {
+    if (iter->scope_->depth_ > depth_)
+      continue;
+    if (iter->scope_->type_ == S_FILE && iter->seq_ > horizon_)
+      continue;
+    if (curScope && iter->scope_ != this)
+      return nullptr;
+    return iter->ident_;
+  }
+  return nullptr;
+}
+
+
+void Scope::Push(Symbol::BindingStack& stack, Identifier* ident) {
+  if (!active_)
+    return;
+  stack.push_back({this, ident, ++seq_});
+  pushed_.push_back(&stack);
+}
 
 
 Identifier* Scope::Find(const Token* tok) {
-  auto ret = Find(tok->str_);
+  Identifier* ret;
+  if (active_) {
+    ret = Lookup(Symbol::Intern(tok)->ordinary_, false);
+  } else {
+    auto scope = this;
+    while ((ret = scope->FindInCurScope(tok->str_)) == nullptr &&
+           scope->type_ != S_FILE && scope->parent_ != nullptr) {
+      scope = scope->parent_;
+    }
+  }
   if (ret) ret->SetTok(tok);
   return ret;
 }
 
 
 Identifier* Scope::FindInCurScope(const Token* tok) {
-  auto ret = FindInCurScope(tok->str_);
+  Identifier* ret;
+  if (active_) {
+    ret = Lookup(Symbol::Intern(tok)->ordinary_, true);
+  } else {
+    ret = FindInCurScope(tok->str_);
+  }
   if (ret) ret->SetTok(tok);
   return ret;
 }
 
 
 Identifier* Scope::FindTag(const Token* tok) {
-  auto ret = FindTag(tok->str_);
+  Identifier* ret = nullptr;
+  if (active_) {
+    ret = Lookup(Symbol::Intern(tok)->tags_, false);
+  } else {
+    for (auto scope = this; scope; scope = scope->parent_) {
+      auto tag = scope->tagMap_.find(tok->str_);
+      if (tag != scope->tagMap_.end()) {
+        ret = tag->second;
+        break;
+      }
+      if (scope->type_ == S_FILE)
+        break;
+    }
+  }
+  assert(ret == nullptr || ret->ToTypeName());
   if (ret) ret->SetTok(tok);
   return ret;
 }
 
 
 Identifier* Scope::FindTagInCurScope(const Token* tok) {
-  auto ret = FindTagInCurScope(tok->str_);
+  Identifier* ret = nullptr;
+  if (active_) {
+    ret = Lookup(Symbol::Intern(tok)->tags_, true);
+  } else {
+    auto tag = tagMap_.find(tok->str_);
+    if (tag != tagMap_.end())
+      ret = tag->second;
+  }
+  assert(ret == nullptr || ret->ToTypeName());
   if (ret) ret->SetTok(tok);
   return ret;
 }
@@ -40,17 +138,10 @@ void Scope::Insert(Identifier* ident) {
 
 
 void Scope::InsertTag(Identifier* ident) {
-  Insert(TagName(ident->Name()), ident);
-}
-
-
-Identifier* Scope::Find(const std::string& name) {
-  auto ident = identMap_.find(name);
-  if (ident != identMap_.end())
-    return ident->second;
-  if (type_ == S_FILE || parent_ == nullptr)
-    return nullptr;
-  return parent_->Find(name);
+  const auto& name = ident->Name();
+  assert(tagMap_.find(name) == tagMap_.end());
+  tagMap_[name] = ident;
+  Push(Symbol::Intern(name)->tags_, ident);
 }
 
 
@@ -65,29 +156,14 @@ Identifier* Scope::FindInCurScope(const std::string& name) {
 void Scope::Insert(const std::string& name, Identifier* ident) {
   assert(FindInCurScope(name) == nullptr);
   identMap_[name] = ident;
-}
-
-
-Identifier* Scope::FindTag(const std::string& name) {
-  auto tag = Find(TagName(name));
-  if (tag) assert(tag->ToTypeName());
-  return tag;
-}
-
-
-Identifier* Scope::FindTagInCurScope(const std::string& name) {
-  auto tag = FindInCurScope(TagName(name));
-  assert(tag == nullptr || tag->ToTypeName());
-  return tag;
+  Push(Symbol::Intern(name)->ordinary_, ident);
 }
 
 
 Scope::TagList Scope::AllTagsInCurScope() const {
   TagList tags;
-  for (auto& kv: identMap_) {
-    if (IsTagName(kv.first))
-      tags.push_back(kv.second);
-  }
+  for (auto& kv: tagMap_)
+    tags.push_back(kv.second);
   return tags;
 }
 
@@ -8,6 +8,7 @@
 
 
 class Identifier;
+class Scope;
 class Token;
 
 
@@ -19,19 +20,54 @@ enum ScopeType {
 };
 
 
+/*
+ * Every distinct identifier name is interned into exactly one symbol,
+ * which holds the stacks of bindings visible from the active scopes.
+ * Ordinary identifiers and tags live in separate name spaces.
+ * A scope pushes its bindings when inserting and pops them on Exit(),
+ * so the innermost binding is always at the back of the stack.
+ */
+struct Binding {
+  Scope* scope_;
+  Identifier* ident_;
+  int seq_;   // Bindings are numbered in the order they are made
+};
+
+struct Symbol {
+  using BindingStack = std::vector<Binding>;
+
+  static Symbol* Intern(const std::string& name);
+  static Symbol* Intern(const Token* tok);
+
+  BindingStack ordinary_;
+  BindingStack tags_;
+};
+
+
 class Scope {
-  friend class StructType;
   using TagList = std::vector<Identifier*>;
   using IdentMap = std::map<std::string, Identifier*>;
+  using SymbolList = std::vector<Symbol::BindingStack*>;
 
 public:
   explicit Scope(Scope* parent, enum ScopeType type)
-      : parent_(parent), type_(type) {}
+      : parent_(parent), type_(type),
+        depth_(parent ? parent->depth_ + 1: 0), active_(false) {}
   ~Scope() {}
   Scope* Parent() { return parent_; }
   void SetParent(Scope* parent) { parent_ = parent; }
   enum ScopeType Type() const { return type_; }
 
+  // Only the scopes on the chain of the parser's current scope are active.
+  // Their bindings are tracked by the symbol stacks.
+  void Enter() { active_ = true; }
+  void Exit();
+
+  // File scope bindings made after the horizon are invisible,
+  // like to a function body parsed later than where it is written.
+  static int LastSeq() { return seq_; }
+  static void SetHorizon(int seq) { horizon_ = seq; }
+
   Identifier* Find(const Token* tok);
   Identifier* FindInCurScope(const Token* tok);
   Identifier* FindTag(const Token* tok);
@@ -48,23 +84,23 @@ public:
   size_t size() const { return identMap_.size(); }
 
 private:
-  Identifier* Find(const std::string& name);
   Identifier* FindInCurScope(const std::string& name);
-  Identifier* FindTag(const std::string& name);
-  Identifier* FindTagInCurScope(const std::string& name);
-  std::string TagName(const std::string& name) {
-    return name + "@:tag";
-  }
-  static bool IsTagName(const std::string& name) {
-    return name.size() > 5 && name[name.size() - 5] == '@';
-  }
+  Identifier* Lookup(const Symbol::BindingStack& stack, bool curScope);
+  void Push(Symbol::BindingStack& stack, Identifier* ident);
   const Scope& operator=(const Scope& other);
   Scope(const Scope& scope);
 
   Scope* parent_;
   enum ScopeType type_;
+  int depth_;
+  bool active_;
 
   IdentMap identMap_;
+  IdentMap tagMap_;
+  SymbolList pushed_;
+
+  static int seq_;
+  static int horizon_;
 };
 
 #endif
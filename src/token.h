@@ -17,6 +17,7 @@ class Parser;
 class Scanner;
 class Token;
 class TokenSequence;
+struct Symbol;
 
 using HideSet = std::set<std::string>;
 using TokenList = std::list<const Token*>;
@@ -206,6 +207,7 @@ public:
     loc_ = other.loc_;
     str_ = other.str_;
     hs_ = other.hs_ ? new HideSet(*other.hs_): nullptr;
+    sym_ = nullptr;
     return *this;
   }
   virtual ~Token() {}
@@ -245,6 +247,9 @@ public:
   std::string str_;
   HideSet* hs_ { nullptr };
 
+  // Interned symbol of an identifier, resolved lazily by the parser
+  mutable Symbol* sym_ { nullptr };
+
 private:
   explicit Token(int tag): tag_(tag) {}
   Token(int tag, const SourceLocation& loc,
@@ -7,6 +7,7 @@
 #include <cassert>
 #include <algorithm>
 #include <iostream>
+#include <unordered_map>
 
 
 static MemPoolImp<VoidType>     voidTypePool;
@@ -17,6 +18,39 @@ static MemPoolImp<StructType>   structUnionTypePool;
 static MemPoolImp<ArithmType>   arithmTypePool;
 
 
+/*
+ * Derived types are hash-consed: structurally identical pointer types
+ * and complete array types share one node, so that Compatible()
+ * usually reduces to a pointer comparison.
+ * Incomplete arrays are never shared, as their length is decided later.
+ * Function types are not shared, as they own the parameter objects and
+ * record whether the function has been defined.
+ */
+struct DerivedKey {
+  intptr_t derived_;
+  int len_;
+  bool operator==(const DerivedKey& other) const {
+    return derived_ == other.derived_ && len_ == other.len_;
+  }
+};
+
+struct DerivedKeyHash {
+  size_t operator()(const DerivedKey& key) const {
+    return std::hash<intptr_t>()(key.derived_) * 31 + key.len_;
+  }
+};
+
+static DerivedKey MakeKey(QualType derived, int len=0) {
+  auto ptr = reinterpret_cast<intptr_t>(derived.GetPtr());
+  return {ptr | derived.Qual(), len};
+}
+
+static std::unordered_map<DerivedKey, PointerType*,
+                          DerivedKeyHash> pointerTypes;
+static std::unordered_map<DerivedKey, ArrayType*,
+                          DerivedKeyHash> arrayTypes;
+
+
 QualType Type::MayCast(QualType type, bool inProtoScope) {
   auto funcType = type->ToFunc();
   auto arrayType = type->ToArray();
@@ -85,8 +119,16 @@ ArithmType* ArithmType::New(int typeSpec) {
 
 
 ArrayType* ArrayType::New(int len, QualType eleType) {
-  return new (arrayTypePool.Alloc())
-         ArrayType(&arrayTypePool, len, eleType);
+  if (len < 0) {
+    return new (arrayTypePool.Alloc())
+           ArrayType(&arrayTypePool, len, eleType);
+  }
+  auto& ret = arrayTypes[MakeKey(eleType, len)];
+  if (ret == nullptr) {
+    ret = new (arrayTypePool.Alloc())
+          ArrayType(&arrayTypePool, len, eleType);
+  }
+  return ret;
 }
 
 
@@ -106,8 +148,12 @@ FuncType* FuncType::New(QualType derived,
 
 
 PointerType* PointerType::New(QualType derived) {
-  return new (pointerTypePool.Alloc())
-         PointerType(&pointerTypePool, derived);
+  auto& ret = pointerTypes[MakeKey(derived)];
+  if (ret == nullptr) {
+    ret = new (pointerTypePool.Alloc())
+          PointerType(&pointerTypePool, derived);
+  }
+  return ret;
 }
 
 
@@ -263,6 +309,8 @@ std::string ArithmType::Str() const {
 
 
 bool PointerType::Compatible(const Type& other) const {
+  if (this == &other)
+    return true;
   // C11 6.7.6.1 [2]: pointer compatibility
   auto otherPointer = other.ToPointer();
   return otherPointer && derived_->Compatible(*otherPointer->derived_);
@@ -277,6 +325,8 @@ bool ArrayType::Compatible(const Type& other) const {
   // C11 6.7.6.2 [6]: For two array type to be compatible,
   // the element types must be compatible, and have same length
   // if both specified.
+  if (this == &other)
+    return true;
   auto otherArray = other.ToArray();
   if (!otherArray) return false;
   if (!derived_->Compatible(*otherArray->derived_)) return false;
@@ -288,6 +338,8 @@ bool ArrayType::Compatible(const Type& other) const {
 
 
 bool FuncType::Compatible(const Type& other) const {
+  if (this == &other)
+    return true;
   auto otherFunc = other.ToFunc();
   // The other type is not an function type
   if (!otherFunc) return false;
@@ -341,20 +393,28 @@ StructType::StructType(MemPool* pool,
       bitFieldAlign_(1) {}
 
 
-Object* StructType::GetMember(const std::string& member) {
-  auto ident = memberMap_->FindInCurScope(member);
-  if (ident == nullptr)
+Object* StructType::GetMember(const std::string& member) const {
+  auto field = GetField(member);
+  return field ? field->member_: nullptr;
+}
+
+
+const StructType::Field* StructType::GetField(
+    const std::string& member) const {
+  auto iter = fieldMap_.find(member);
+  if (iter == fieldMap_.end())
     return nullptr;
-  return ident->ToObject();
+  return &fields_[iter->second];
 }
 
 
-void StructType::CalcWidth() {
-  width_ = 0;
-  auto iter = memberMap_->identMap_.begin();
-  for (; iter != memberMap_->identMap_.end(); ++iter) {
-    width_ += iter->second->Type()->Width();
-  }
+void StructType::AddField(Object* member, int offset) {
+  const auto& name = member->Name();
+  if (fieldMap_.find(name) != fieldMap_.end())
+    Error(member, "duplicated member '%s'", name.c_str());
+  fieldMap_[name] = fields_.size();
+  fields_.push_back({member, offset, static_cast<int>(members_.size()) - 1,
+                     member->BitFieldBegin(), member->BitFieldWidth()});
 }
 
 
@@ -370,14 +430,27 @@ std::string StructType::Str() const {
 }
 
 
-// Remove useless unnamed bitfield members as they are just for parsing
+// Remove useless unnamed bitfield members as they are just for parsing,
+// then point every field to the member that encloses it.
 void StructType::Finalize() {
-  for (auto iter = members_.begin(); iter != members_.end();) {
-    if ((*iter)->BitFieldWidth() && (*iter)->Anonymous()) {
-      members_.erase(iter++);
-    } else {
-      ++iter;
+  auto useless = [](Object* member) {
+    return member->BitFieldWidth() && member->Anonymous();
+  };
+  members_.erase(std::remove_if(members_.begin(), members_.end(), useless),
+                 members_.end());
+
+  for (size_t i = 0; i < members_.size(); ++i) {
+    auto member = members_[i];
+    if (!member->Anonymous()) {
+      fields_[fieldMap_[member->Name()]].index_ = i;
+      continue;
     }
+    // Unnamed bitfields of zero width have no fields
+    auto anonyType = member->Type()->ToStruct();
+    if (anonyType == nullptr)
+      continue;
+    for (auto& field: anonyType->fields_)
+      fields_[fieldMap_[field.member_->Name()]].index_ = i;
   }
 }
 
@@ -387,7 +460,7 @@ void StructType::AddMember(Object* member) {
   member->SetOffset(offset);
 
   members_.push_back(member);
-  memberMap_->Insert(member->Name(), member);
+  AddField(member, offset);
 
   align_ = std::max(align_, member->Align());
   bitFieldAlign_ = std::max(bitFieldAlign_, align_);
@@ -407,7 +480,7 @@ void StructType::AddBitField(Object* bitField, int offset) {
   bitField->SetOffset(offset);
   members_.push_back(bitField);
   if (!bitField->Anonymous())
-    memberMap_->Insert(bitField->Name(), bitField);
+    AddField(bitField, offset);
 
   auto bytes = MakeAlign(bitField->BitFieldEnd(), 8) / 8;
   bitFieldAlign_ = std::max(bitFieldAlign_, bitField->Align());
@@ -427,25 +500,18 @@ void StructType::MergeAnony(Object* anony) {
   auto anonyType = anony->Type()->ToStruct();
   auto offset = MakeAlign(offset_, anony->Align());
 
-  // Members in map are never anonymous
-  for (auto& kv: *anonyType->memberMap_) {
-    auto& name = kv.first;
-    auto member = kv.second->ToObject();
-    if (member == nullptr) {
-      continue;
-    }
+  anony->SetOffset(offset);
+  members_.push_back(anony);
+
+  // Fields are never anonymous
+  for (auto& field: anonyType->fields_) {
     // Every member of anonymous struct/union
     // are offseted by external struct/union
-    member->SetOffset(offset + member->Offset());
-
-    if (GetMember(name)) {
-      Error(member, "duplicated member '%s'", name.c_str());
-    }
+    auto member = field.member_;
+    member->SetOffset(offset + field.offset_);
     // Simplify anony struct's member searching
-    memberMap_->Insert(name, member);
+    AddField(member, member->Offset());
   }
-  anony->SetOffset(offset);
-  members_.push_back(anony);
 
   align_ = std::max(align_, anony->Align());
   if (isStruct_) {
@@ -8,6 +8,7 @@
 #include <cassert>
 #include <cstdint>
 #include <list>
+#include <unordered_map>
 
 
 class Scope;
@@ -61,6 +62,9 @@ enum {
   // Function specifier
   F_INLINE = 0x4000000,
   F_NORETURN = 0x8000000,
+  // GNU extension: always_inline and noinline attributes
+  F_ALWAYS_INLINE = 0x10000000,
+  F_NOINLINE = 0x20000000,
 };
 
 
@@ -334,6 +338,9 @@ public:
   bool Variadic() const { return variadic_; }
   bool IsInline() const { return inlineNoReturn_ & F_INLINE; }
   bool IsNoReturn() const { return inlineNoReturn_ & F_NORETURN; }
+  bool IsAlwaysInline() const { return inlineNoReturn_ & F_ALWAYS_INLINE; }
+  bool IsNoInline() const { return inlineNoReturn_ & F_NOINLINE; }
+  void AddFuncSpec(int funcSpec) { inlineNoReturn_ |= funcSpec; }
 
 protected:
   FuncType(MemPool* pool, QualType derived, int inlineReturn,
@@ -352,8 +359,20 @@ private:
 
 class StructType : public Type {
 public:
-  using MemberList = std::list<Object*>;
-  using Iterator = std::list<Object*>::iterator;
+  using MemberList = std::vector<Object*>;
+  using Iterator = MemberList::iterator;
+
+  // Every named member, including those merged from anonymous
+  // struct/union, with its layout resolved against this struct/union.
+  struct Field {
+    Object* member_;
+    int offset_;
+    int index_;   // Index of the enclosing entry in members_
+    unsigned char bitFieldBegin_;
+    unsigned char bitFieldWidth_;
+  };
+  using FieldList = std::vector<Field>;
+  using FieldMap = std::unordered_map<std::string, int>;
 
 public:
   static StructType* New(bool isStruct,
@@ -371,7 +390,9 @@ public:
   void AddMember(Object* member);
   void AddBitField(Object* member, int offset);
   bool IsStruct() const { return isStruct_; }
-  Object* GetMember(const std::string& member);
+  Object* GetMember(const std::string& member) const;
+  const Field* GetField(const std::string& member) const;
+  const FieldList& Fields() const { return fields_; }
   Scope* MemberMap() { return memberMap_; }
   MemberList& Members() { return members_; }
   int Offset() const { return offset_; }
@@ -386,13 +407,15 @@ protected:
   StructType(const StructType& other);
 
 private:
-  void CalcWidth();
+  void AddField(Object* member, int offset);
 
   bool isStruct_;
   bool hasTag_;
   Scope* memberMap_;
 
   MemberList members_;
+  FieldList fields_;
+  FieldMap fieldMap_;
   int offset_;
   int width_;
   int align_;
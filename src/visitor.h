@@ -14,6 +14,8 @@ class TempVar;
 
 class Declaration;
 class IfStmt;
+class SwitchStmt;
+class LoopStmt;
 class JumpStmt;
 class ReturnStmt;
 class LabelStmt;
@@ -38,6 +40,8 @@ public:
 
   virtual void VisitDeclaration(Declaration* init) = 0;
   virtual void VisitIfStmt(IfStmt* ifStmt) = 0;
+  virtual void VisitSwitchStmt(SwitchStmt* switchStmt) = 0;
+  virtual void VisitLoopStmt(LoopStmt* loopStmt) = 0;
   virtual void VisitJumpStmt(JumpStmt* jumpStmt) = 0;
   virtual void VisitReturnStmt(ReturnStmt* returnStmt) = 0;
   virtual void VisitLabelStmt(LabelStmt* labelStmt) = 0;
@@ -89,8 +89,126 @@ static void test_comma() {
     expect(7.0, (1, 3, 5, 7.0));
 }
 
+static int seven() {
+    return 7;
+}
+
+static void test_operands() {
+    int a = 12, b = 5;
+    long l = -9;
+    unsigned u = 4000000000u;
+    double d = 2.5;
+    expect(-2, 10 - a);
+    expect(2, a % b);
+    expect(4, a / 3);
+    expect(0, u / 4000000001u);
+    expect(60, a * b);
+    expect(384, a << b);
+    expect(1, 3 < a);
+    expect(-5, l >> 1);
+    expect(1, u > 3999999999u);
+    expectf(7.5, d * 3.0);
+    expectf(-0.5, 2.0 - d);
+    expect(1, d > 2.0);
+    expect(-77, seven() * (1 - a));
+    expect(71, (a - 1) * seven() - (b + 1));
+
+    struct { int x, y, z; } s[4] = {{1, 2, 3}, {4, 5, 6}, {7, 8, 9}};
+    int arr[5] = {1, 2, 3, 4, 5};
+    int *p = arr + 4;
+    long i = 2;
+    expect(8, s[i].y);
+    expect(9, (s + 3 - 1)->z);
+    expect(2, *(p - 3));
+    expect(3, p[-i]);
+    expect(4, p - arr);
+}
+
+static int fold_dead(int x) {
+    if (0) {
+    inside:
+        return x + 100;
+    }
+    if (x > 5)
+        goto inside;
+    return x;
+    x = 42;
+}
+
+static void test_fold() {
+    expect(44, (unsigned char)300);
+    expect(1, (1 << 31) < 0);
+    expect(2, (int)2.7);
+    expect(1, (_Bool)0.5);
+    expect(1, 0.5 < 0.7);
+    expect(0, -1 / 2);
+    expect(-1, -7 >> 3);
+    expect(2147483647, (unsigned)-1 >> 1);
+    expectl(6148914691236517205, 0xffffffffffffffffUL / 3);
+    expect(1, 0xffffffffffffffffUL > 1);
+    expect(1, (float)0.1 == 0.1f);
+    expect(0, (double)(float)0.1 == 0.1);
+    expect(4, sizeof(int) * 2 - 4);
+    if (0)
+        expect(0, 1 / 0);
+
+    const int n = 10;
+    int k = n * 4 + 0;
+    int m = 7;
+    m = m + 1;
+    expect(40, k);
+    expect(8, m);
+    while (0)
+        m = 0;
+    do {
+        m++;
+    } while (0);
+    expect(9, m);
+    expect(5, 1 ? 5 : seven());
+    expect(0, 0 && seven());
+    expect(1, 1 || seven());
+    expect(3, fold_dead(3));
+    expect(106, fold_dead(6));
+}
+
+static void test_const_divisor() {
+    int n[] = {0, 7, -7, 100, -100, 2147483647, -2147483647 - 1};
+    for (int i = 0; i < 7; i++) {
+        int x = n[i];
+        volatile int d10 = 10, d16 = 16, d7 = 7;
+        unsigned u = x;
+        volatile unsigned ud10 = 10, ud16 = 16, ud7 = 7;
+        long l = x * 3000000000L;
+        volatile long ld10 = 10, ld16 = 16, ld7 = 7;
+        unsigned long ul = l;
+        volatile unsigned long uld10 = 10, uld7 = 7;
+        expect(x / d10, x / 10);
+        expect(x % d10, x % 10);
+        expect(x / d16, x / 16);
+        expect(x % d16, x % 16);
+        expect(x / -d7, x / -7);
+        expect(x % -d16, x % -16);
+        expect(u / ud10, u / 10);
+        expect(u % ud7, u % 7);
+        expect(u / ud16, u / 16);
+        expect(u % ud16, u % 16);
+        expectl(l / ld10, l / 10);
+        expectl(l % ld7, l % 7);
+        expectl(l / ld16, l / 16);
+        expectl(l % ld16, l % 16);
+        expectl(ul / uld10, ul / 10);
+        expectl(ul % uld7, ul % 7);
+        expect(x * 3 * 8, x * 24);
+        expect(-x - x, x * -2);
+        expectl(l * 5 * 2, l * 10);
+    }
+}
+
 int main() {
     test_basic();
+    test_operands();
+    test_fold();
+    test_const_divisor();
     test_relative();
     test_inc_dec();
     test_bool();
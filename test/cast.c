@@ -17,6 +17,30 @@ static void test_unsignedcast() {
     expect(1, i > 0);
 }
 
+static void test_extension() {
+    int i = -3;
+    signed char c = -2;
+    short s = -5;
+    unsigned u = 4000000000u;
+    long l = 0x100000000;
+    expectd(-3.0, i);
+    expectd(-2.0, c);
+    expectd(-5.0, s);
+    expectd(4000000000.0, u);
+    expect(0, (_Bool)(int)l);
+    expect(1, (unsigned long)u == 4000000000u);
+    expect(-3, (long)i);
+
+    long a[4] = {1, 2, 3, 4}, *p = a + 2;
+    expect(2, p[i + 2]);
+    expect(2, p[c + 1]);
+    switch ((int)(l + 1)) {
+    case 0: expect(0, 1); break;
+    case 1: break;
+    default: expect(0, 1);
+    }
+}
+
 int main() {
     expectf(1, (int)1);
     expectf(1.0, (float)1);
@@ -28,5 +52,6 @@ int main() {
 
     test_signedcast();
     test_unsignedcast();
+    test_extension();
     return 0;
 }
@@ -42,10 +42,45 @@ void test3()
     expect(j, -4);
 }
 
+void test_branch()
+{
+    int a = 3, b = -4;
+    unsigned u = 4000000000u;
+    double d = 0.5;
+    int arr[2];
+    int *p = arr, *q = arr + 1;
+    int n = 0;
+
+    if (a > b && u > 3u && !(d >= 1.0))
+        n += 1;
+    if (a < b || u < 5u || d == 0.25)
+        n += 10;
+    if (!(a < b) && (b < 0 || a / 0))
+        n += 100;
+    if (p < q && !(q <= p) && p != q)
+        n += 1000;
+    expect(1101, n);
+
+    n = 0;
+    while (a > 0 && (b < 0 || a > 2)) {
+        --a;
+        ++n;
+    }
+    expect(3, n);
+    do {
+        ++n;
+    } while (!(n >= 5) || n == 5);
+    expect(6, n);
+    expect(1, a == 0 || b > 0 ? 1: 2);
+    expect(0, (a < 0 && b < 0) || (d > 1 && d < 2));
+    expect(1, u > 1u && p < q);
+}
+
 int main()
 {
     test1();
     test2();
     test3();
+    test_branch();
     return 0;
 }
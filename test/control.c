@@ -200,6 +200,78 @@ static void test_switch() {
         ;
 }
 
+static int dense(int x) {
+    switch (x) {
+    case -2: return 20;
+    case -1: return 10;
+    case 0: return 0;
+    case 1 ... 3: return 1;
+    case 5: return 5;
+    case 6: return 6;
+    default: return 99;
+    }
+}
+
+static int sparse(long x) {
+    switch (x) {
+    case -1000: return 1;
+    case -7: return 2;
+    case 3: return 3;
+    case 64: return 4;
+    case 500: return 5;
+    case 4096: return 6;
+    case 70000: return 7;
+    }
+    return 0;
+}
+
+static int unsigned_cases(unsigned x) {
+    switch (x) {
+    case 0: return 1;
+    case 1: return 2;
+    case 2: return 3;
+    case 3: return 4;
+    case -1: return 5;
+    }
+    return 0;
+}
+
+static void test_switch_dispatch() {
+    expect(20, dense(-2));
+    expect(10, dense(-1));
+    expect(0, dense(0));
+    expect(1, dense(2));
+    expect(99, dense(4));
+    expect(6, dense(6));
+    expect(99, dense(7));
+    expect(99, dense(-3));
+    expect(99, dense(-2147483647 - 1));
+
+    expect(1, sparse(-1000));
+    expect(2, sparse(-7));
+    expect(3, sparse(3));
+    expect(4, sparse(64));
+    expect(5, sparse(500));
+    expect(6, sparse(4096));
+    expect(7, sparse(70000));
+    expect(0, sparse(4));
+    expect(0, sparse(-4294967296 + 3));
+
+    expect(1, unsigned_cases(0));
+    expect(4, unsigned_cases(3));
+    expect(5, unsigned_cases(4294967295u));
+    expect(0, unsigned_cases(4));
+
+    char c = 'b';
+    switch (c) {
+    case 'a': c = 1; break;
+    case 'b': c = 2; break;
+    case 'c': c = 3; break;
+    case 'd': c = 4; break;
+    }
+    expect(2, c);
+}
+
 static void test_goto() {
     int acc = 0;
     goto x;
@@ -283,6 +355,7 @@ int main() {
     test_while();
     test_do();
     test_switch();
+    test_switch_dispatch();
     test_goto();
     test_label();
     //test_computed_goto();
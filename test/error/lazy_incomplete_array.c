@@ -0,0 +1,14 @@
+// @wgtcc: error
+// 'a' is incomplete where the body of 'f' is
+
+extern int a[];
+
+static int f(void) {
+    return sizeof a;
+}
+
+int a[10];
+
+int main(void) {
+    return f();
+}
@@ -0,0 +1,15 @@
+// @wgtcc: error
+// 'struct S' is incomplete where the body of 'f' is
+
+struct S;
+
+static int f(struct S* p) {
+    return p->x;
+}
+
+struct S { int x; };
+
+int main(void) {
+    struct S s = {4};
+    return f(&s);
+}
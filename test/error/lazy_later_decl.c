@@ -0,0 +1,12 @@
+// @wgtcc: error
+// 'y' is declared after the body of 'f'
+
+static int f(void) {
+    return y;
+}
+
+int y = 3;
+
+int main(void) {
+    return f();
+}
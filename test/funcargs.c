@@ -37,7 +37,20 @@ static void mixed(float v01, int v02, float v03, int v04, float v05, int v06, fl
     expectf(37.0, v37); expect(38, v38); expectf(39.0, v39); expect(40, v40);
 }
 
+static int twice(int v) { return v * 2; }
+
+// Arguments clobbering registers are mixed with plain ones
+static void staged() {
+    int x = 7, a[3] = {1, 2, 3}, *p = a;
+    double d = 1.5;
+    many_ints(x / 2 - 2, x % 5, twice(x) - 11, p[1] + 2, (x >> 1 << 1) - 1,
+              6, x << a[0] >> 1, x % 4 * 2 + 2, twice(3) + 3);
+    many_floats(d - 0.5, twice(1), x / 3 + 1, 4, a[2] + 2, d * 4, x, 8,
+                9, 10, 11, 12, 13, 14, 15, twice(8), 17);
+}
+
 int main() {
+    staged();
     many_ints(1, 2, 3, 4, 5, 6, 7, 8, 9);
 
     many_floats(1.0, 2.0,  3.0,  4.0,  5.0,  6.0,  7.0,  8.0,
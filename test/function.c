@@ -221,6 +221,144 @@ static void test_func_ret_struct() {
     expect(10, c);
 }
 
+static int is_odd(int n);
+static int is_even(int n) {
+    return n == 0 ? 1 : is_odd(n - 1);
+}
+static int is_odd(int n) {
+    return n == 0 ? 0 : is_even(n - 1);
+}
+static int twice(int x) { return 2 * x; }
+static int (*funcs[])(int) = {twice, is_even};
+static int hidden() { return 42; }
+static int triple(int x) { return 3 * x; }
+int triple(int);
+int quad(int y) { return 4 * y; }
+int quad(int);
+
+static void test_static_func_use() {
+    extern int hidden();
+    expect(1, is_even(10));
+    expect(1, is_odd(7));
+    expect(8, funcs[0](4));
+    expect(0, funcs[1](3));
+    expect(42, hidden());
+    expect(9, triple(3));
+    expect(12, quad(3));
+}
+
+
+// glibc defines __attribute__ away for compilers other than GCC
+#undef __attribute__
+
+static int square(int x) { return x * x; }
+static inline int max2(int a, int b) {
+    if (a > b)
+        return a;
+    return b;
+}
+static int count() {
+    static int n;
+    return ++n;
+}
+static int sum_to(int n) {
+    int s = 0;
+again:
+    if (n > 0) {
+        s += n--;
+        goto again;
+    }
+    return s;
+}
+static double halve(double d) { return d / 2; }
+static void bump(int* p) { ++*p; }
+__attribute__((noinline)) static int not_inlined(int x) { return x + 1; }
+static inline __attribute__((always_inline)) int grade(int x) {
+    switch (x) {
+    case 1: return 10;
+    case 2: return 20;
+    case 3: return 30;
+    case 4: return 40;
+    default: return -1;
+    }
+}
+
+static void test_inline() {
+    int t = 0;
+    for (int i = 0; i < 4; i++)
+        t += square(i) + max2(i, 2);
+    expect(23, t);
+    expect(9, max2(square(2), max2(3, square(3))));
+    expect(21, count() + count() * 10);
+    expect(15, sum_to(5));
+    expect(6, sum_to(3));
+    expectf(1.5, halve(3.0));
+    bump(&t);
+    expect(24, t);
+    expect(2, not_inlined(1));
+    expect(30, grade(3));
+    expect(-1, grade(9));
+    expect(1, is_even(4));
+}
+
+static long sum_acc(long n, long acc) {
+    if (n == 0)
+        return acc;
+    return sum_acc(n - 1, acc + n);
+}
+static int odd(int n);
+static int even(int n) { return n == 0 ? 1: odd(n - 1); }
+static int odd(int n) {
+    if (n == 0)
+        return 0;
+    return even(n - 1);
+}
+static double halve_n(double d, int n) {
+    if (n == 0)
+        return d;
+    return halve_n(d / 2, n - 1);
+}
+static int deref_n(int* p, int n) {
+    int local = *p + 1;
+    if (n == 0)
+        return *p;
+    return deref_n(&local, n - 1);
+}
+static int (*even_ptr)(int) = even;
+static int call_ptr(int n) { return even_ptr(n); }
+
+static void test_tail_call() {
+    expect(5050, sum_acc(100, 0));
+    expect(1, even(1000));
+    expect(1, odd(999));
+    expectf(1.0, halve_n(1024.0, 10));
+    int v = 3;
+    expect(8, deref_n(&v, 5));
+    expect(0, call_ptr(7));
+}
+
+static int leaf_small(int n) {
+    int a[8];
+    for (int i = 0; i < 8; ++i)
+        a[i] = i * n;
+    return a[7] - a[1];
+}
+static long leaf_large(int n) {
+    long a[64];
+    for (int i = 0; i < 64; ++i)
+        a[i] = i + n;
+    return a[0] + a[63];
+}
+static int leaf_stack_args(int a, int b, int c, int d,
+                           int e, int f, int g, int h) {
+    return a + b + c + d + e + f + g * h;
+}
+
+static void test_leaf_frame() {
+    expect(18, leaf_small(3));
+    expect(65, leaf_large(1));
+    expect(77, leaf_stack_args(1, 2, 3, 4, 5, 6, 7, 8));
+}
 
 int main() {
     expect(77, t1());
@@ -246,5 +384,9 @@ int main() {
     test_return_struct();
     test_func_param();
     test_func_ret_struct();
+    test_static_func_use();
+    test_inline();
+    test_tail_call();
+    test_leaf_frame();
     return 0;
 }
@@ -19,6 +19,13 @@ char *s2 = "ABCD";
 long l1 = 8;
 int *intp = &(int){ 9 };
 
+int zeros[64] = { 0 };
+const int ctab[4] = { 1, 2, 3, 4 };
+const char *const names[] = { "x", "y" };
+short runs[12] = { -2, -2, -2, -2, -2, -2, -2, -2, -2, 7 };
+long lruns[4] = { 1L << 40, 1L << 40, -1, -1 };
+char bytes[32] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 'a', 0, 'b', '"', '\\' };
+
 int main() {
     defaultint = 3;
     expect(3, defaultint);
@@ -48,5 +55,20 @@ int main() {
 
     expectl(8, l1);
     expectl(9, *intp);
+
+    zeros[63] = 1;
+    expect(1, zeros[0] + zeros[63]);
+    expect(4, ctab[3]);
+    expect_string("y", names[1]);
+    expect(-2, runs[8]);
+    expect(7, runs[9]);
+    expect(0, runs[11]);
+    expectl(1L << 40, lruns[1]);
+    expectl(-1, lruns[3]);
+    expect(1, bytes[8]);
+    expect('a', bytes[9]);
+    expect(0, bytes[10]);
+    expect('\\', bytes[13]);
+    expect(0, bytes[31]);
     return 0;
 }
@@ -312,6 +312,37 @@ static void test_struct_anonymous_complex() {
     expect(3, foo1.h.g);
 }
 
+static void test_block_zero() {
+    int a[300] = {1, [150] = 2, [299] = 3};
+    long sum = 0;
+    for (int i = 0; i < 300; i++)
+        sum += a[i] * (i + 1);
+    expect(1203, sum);
+
+    struct { char c; int i; char d; long l; } s[3] = {{1, 2, 3, 4}, {5}};
+    expect(0, s[1].d + s[1].l + s[2].c + s[2].l);
+    char str[37] = "hi";
+    expect(0, str[2] + str[20] + str[36]);
+}
+
+static void test_static_designator() {
+    static int t[8] = { [7] = 7, [5] = 5, [3] = 3, [1] = 1, [5] = 6, 8 };
+    expect(7, t[7]);
+    expect(6, t[5]);
+    expect(8, t[6]);
+    expect(0, t[0] + t[2] + t[4]);
+    expect(4, t[1] + t[3]);
+
+    int u[6] = { [4] = 4, [2] = 2, [4] = 5, [0] = 1, 3 };
+    expect(5, u[4]);
+    expect(3, u[1]);
+    expect(3, u[0] + u[2]);
+    expect(0, u[3] + u[5]);
+    struct { int a, b; } v = { .b = 2, .a = 1, .b = 3 };
+    expect(1, v.a);
+    expect(3, v.b);
+}
+
 // static test_static_compound_literal_initializer
 struct S {
     int a;
@@ -340,5 +371,7 @@ int main() {
     test_struct_anonymous_1();
     test_struct_anonymous_2();
     test_struct_anonymous_complex();
+    test_block_zero();
+    test_static_designator();
     return 0;
 }
@@ -87,6 +87,15 @@ static void test_float() {
     //expectd(1.0, 1.0L);
     expectf(1.0, 0x1p+0);
     expectf(1.0, 0x1p-0);
+
+    double zero = 0.0, negzero = -0.0;
+    expect(0, memcmp(&zero, "\0\0\0\0\0\0\0\0", 8));
+    expect(1, 1 / negzero < 0);
+    expectf(0.5, 0.5);
+    expectf(0.5f, 0.5f);
+    expect_string("pooled", "pooled");
+    expect_string("a\0b", "a");
+    expect('b', "a\0b"[2]);
 }
 
 static void test_ucn() {
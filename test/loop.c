@@ -31,11 +31,135 @@ void test3()
     expect(sum, 45);
 }
 
+void test4()
+{
+    int i = 0, sum = 0;
+    do {
+        if (++i % 2)
+            continue;
+        sum += i;
+    } while (i < 10);
+    expect(sum, 30);
+
+    for (i = 0; i < 0; ++i)
+        sum = -1;
+    expect(sum, 30);
+    while (sum > 100)
+        sum = -1;
+    expect(sum, 30);
+
+    for (i = 0;; ++i) {
+        if (i == 3)
+            continue;
+        if (i > 5)
+            break;
+        sum += i;
+    }
+    expect(sum, 42);
+
+    int n = 0;
+    do {
+        ++n;
+    } while (0);
+    expect(n, 1);
+
+    goto inside;
+    while (0) {
+inside:
+        ++n;
+    }
+    expect(n, 2);
+}
+
+void add_floats(float *a, float *b, float *c, int n)
+{
+    for (int i = 0; i < n; ++i)
+        a[i] = b[i] * c[i] + b[i];
+}
+
+void axpy(double *y, double *x, double s, int n)
+{
+    for (int i = 0; i < n; i++)
+        y[i] += s * x[i];
+}
+
+void shift_ints(int *restrict a, int *b, int n)
+{
+    int i;
+    for (i = 0; i < n; i = i + 1)
+        a[i] = b[i] - 3;
+}
+
+long lvec[9];
+char cvec[19];
+short svec[13];
+
+void fill_chars(char k, int n)
+{
+    for (int i = 0; i < n; i++)
+        cvec[i] = k;
+}
+
+void fill_shorts(short k, int n)
+{
+    for (int i = 0; i < n; i++)
+        svec[i] = k;
+}
+
+void test5()
+{
+    float a[11], b[11], c[11];
+    for (int i = 0; i < 11; i++) {
+        b[i] = i;
+        c[i] = 2;
+    }
+    add_floats(a, b, c, 11);
+    for (int i = 0; i < 11; i++)
+        expectf(3 * i, a[i]);
+
+    double y[7], x[7];
+    for (int i = 0; i < 7; i++) {
+        y[i] = i;
+        x[i] = 1;
+    }
+    axpy(y, x, 0.5, 7);
+    for (int i = 0; i < 7; i++)
+        expectd(i + 0.5, y[i]);
+
+    int s[20], t[20];
+    for (int i = 0; i < 20; i++)
+        s[i] = i;
+    shift_ints(t, s, 20);
+    expect(16, t[19]);
+    // Overlapping arrays run the scalar loop
+    int *p = s + 1;
+    for (int i = 0; i < 19; i++)
+        p[i] = s[i] + 1;
+    for (int i = 0; i < 20; i++)
+        expect(i, s[i]);
+
+    for (int i = 0; i < 9; i++)
+        lvec[i] = (1L << 40) + i;
+    for (int i = 0; i < 9; i++)
+        lvec[i] = lvec[i] ^ 5;
+    expectl((1L << 40) ^ 13, lvec[8]);
+
+    // Narrow elements stay scalar
+    fill_chars(5, 19);
+    for (int i = 0; i < 19; i++)
+        expect(5, cvec[i]);
+    fill_shorts(-2, 13);
+    for (int i = 0; i < 13; i++)
+        expect(-2, svec[i]);
+}
+
 int main()
 {
     test1();
     test2();
     test3();
+    test4();
+    test5();
     return 0;
 }
 
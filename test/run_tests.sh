@@ -10,10 +10,29 @@ run_test_case() {
     test_case=$1
 
     echo "====== test case: [ ${test_case} ] ======"
-    ${WGTCC} -no-pie -I${CUR_DIR=}/../include ${test_case}
+    ${WGTCC} ${WGTCC_FLAGS} -no-pie -I${CUR_DIR=}/../include ${test_case}
     ./a.out
 }
 
+# The IR of every case must pass the verifier
+run_ir_case() {
+    test_case=$1
+
+    echo "====== ir case: [ ${test_case} ] ======"
+    err=$(${WGTCC} ${WGTCC_FLAGS} -emit-ir -I${CUR_DIR=}/../include ${test_case} -o /dev/null 2>&1)
+    [ -z "${err}" ] || { echo "${err}"; return 1; }
+}
+
+# The cases in error/ must be rejected by the compiler
+run_error_case() {
+    test_case=$1
+
+    echo "====== error case: [ ${test_case} ] ======"
+    rm -f a.out
+    ${WGTCC} ${WGTCC_FLAGS} -no-pie -I${CUR_DIR=}/../include ${test_case} 2>/dev/null
+    [ ! -e a.out ]
+}
+
 main () {
     test_case_to_run=""
 
@@ -35,6 +54,29 @@ main () {
         total_case_count=$((total_case_count + 1))
     done
 
+    for test_case in ${CUR_DIR}/*.c; do
+        if [ ! -z ${test_case_to_run} ] && [ ${test_case} != ${test_case_to_run} ]; then
+            continue
+        fi
+
+        if ! run_ir_case ${test_case}; then
+            failed_case_count=$((failed_case_count + 1))
+        fi
+        total_case_count=$((total_case_count + 1))
+    done
+
+    for test_case in ${CUR_DIR}/error/*.c; do
+        if [ ! -z ${test_case_to_run} ] && [ ${test_case} != ${test_case_to_run} ]; then
+            continue
+        fi
+
+        if ! run_error_case ${test_case}; then
+            echo "accepted: ${test_case}"
+            failed_case_count=$((failed_case_count + 1))
+        fi
+        total_case_count=$((total_case_count + 1))
+    done
+
     echo "###### tests end ######"
 
     if [ ${failed_case_count} != 0 ]; then
@@ -260,6 +260,15 @@ static void bitfield_unnamed() {
     expect(1026, y.i);
 }
 
+static void bitfield_zero_width_first() {
+    struct { int :0; int a; } s = { 3 };
+    union { int :0; int a; } u;
+    u.a = 4;
+    expect(3, s.a);
+    expect(4, u.a);
+    expect(4, sizeof(s));
+}
+
 struct { char a:4; char b:4; } inittest = { 2, 4 };
 
 static void bitfield_initializer() {
@@ -317,6 +326,24 @@ static void empty_struct() {
     expect(0, sizeof(union tag16));
 }
 
+static struct big { long l[125]; char t[7]; } big;
+
+static void block_copy() {
+    struct { char c[40]; } b, c;
+    for (int i = 0; i < 40; i++)
+        b.c[i] = i;
+    c = b;
+    expect(39, c.c[39]);
+    expect(20, c.c[20]);
+
+    for (int i = 0; i < 125; i++)
+        big.l[i] = i;
+    big.t[6] = 9;
+    struct big copy = big;
+    expect(124, copy.l[124]);
+    expect(9, copy.t[6]);
+}
+
 void test1()
 {
     typedef struct {
@@ -539,6 +566,20 @@ static void test_unnamed_bitfield() {
   expect(2, foo.c);
 }
 
+static void test_member_namespace() {
+  typedef int T;
+  struct {
+    int a;
+    struct { int b; union { int c; char d; }; };
+    int T;
+    T e;
+  } v = { .c = 5, .a = 1, .T = 3, 4 };
+  expect(1, v.a);
+  expect(5, v.c);
+  expect(3, v.T);
+  expect(4, v.e);
+}
+
 int main()
 {
     test1();
@@ -574,14 +615,17 @@ int main()
     bitfield_mix();
     bitfield_union();
     bitfield_unnamed();
+    bitfield_zero_width_first();
     bitfield_initializer();
     test_offsetof();
     test_bitfield_static_initializer();
     test_bitfield_mix();
     test_unnamed_bitfield();
+    test_member_namespace();
 #ifdef __8cc__
     flexible_member();
 #endif
     empty_struct();
+    block_copy();
     return 0;
 }
@@ -0,0 +1,82 @@
+// @wgtcc: passed
+
+#include "test.h"
+
+static int id(int x) {
+    return x;
+}
+
+static double idf(double x) {
+    return x;
+}
+
+static void deep_int() {
+    int a = 1, b = 2, c = 3, d = 4;
+    expect(43, a + (b + (c + (d + (a + (b + (c + (d + (a * (b + (c * (d + 3))))))))))));
+    expect(59, (a + b) * (c + d) + (a + c) * (b + d) + (a + d) * (b + c) - 11);
+}
+
+static void across_calls() {
+    int a = 5;
+    expect(36, a + id(a + id(a + id(a + id(a + id(a + id(a + id(1))))))));
+    expect(21, id(1) + id(2) + id(3) + id(4) + id(5) + id(6));
+    expect(720, id(1) * id(2) * id(3) * id(4) * id(5) * id(6));
+}
+
+static void deep_float() {
+    double x = 1.5;
+    expectf(13.5, x + (x + (x + (x + (x + (x + (x + (x + (x * 0)))))))) + 1.5);
+    expectf(6.0, idf(1.0) + idf(2.0) * (idf(3.0) - idf(2.0)) + idf(3.0));
+}
+
+static void many_args() {
+    expect(7, id(id(1) + id(2) * id(3)));
+    expectf(4.5, idf(idf(1.5) * idf(3.0)));
+}
+
+static int sum_nested(int n) {
+    int sum = 0;
+    for (int i = 0; i < n; ++i)
+        for (int j = 0; j <= i; ++j)
+            sum += j;
+    return sum;
+}
+
+static void promoted_locals() {
+    int arr[10];
+    for (int i = 0; i < 10; ++i)
+        arr[i] = i * i;
+    long sum = 0;
+    int i = 0;
+    while (i < 10)
+        sum += arr[i++];
+    expect(285, sum);
+    expect(165, sum_nested(10));
+
+    char c = 127;
+    unsigned char uc = 255;
+    short s = -1;
+    ++c; ++uc; --s;
+    expect(-128, c);
+    expect(0, uc);
+    expect(-2, s);
+
+    double acc = 0;
+    for (float f = 0.5f; f < 3; f += 1)
+        acc += f;
+    expectf(4.5, acc);
+
+    // Addressed locals stay in memory
+    int k = 1, *p = &k;
+    *p = 2;
+    expect(2, k);
+}
+
+int main() {
+    deep_int();
+    promoted_locals();
+    across_calls();
+    deep_float();
+    many_args();
+    return 0;
+}
@@ -60,6 +60,17 @@ static double sumif(int n, ...) {
   return acc;
 }
 
+// The last named param fills the registers, the rest are in memory
+static long digits(int a1, int a2, int a3, int a4, int a5, int a6, ...) {
+  va_list args;
+  va_start(args, a6);
+  long acc = a6;
+  for (int i = 0; i < 3; ++i)
+    acc = acc * 10 + va_arg(args, int);
+  va_end(args);
+  return acc;
+}
+
 typedef struct {
   int x;
   int y;
@@ -83,6 +94,7 @@ static void test() {
 
   pos_t pos = {3, 7};
   expect(10, test_struct(1, 2, 3, 4, 5, 6, 7, pos));
+  expect(6789, digits(1, 2, 3, 4, 5, 6, 7, 8, 9));
 }
 
 int main() {